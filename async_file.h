@@ -0,0 +1,337 @@
+#ifndef ASYNC_FILE_H
+#define ASYNC_FILE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+//Define ASYNC_FILE_NO_IO_URING to always write through the pwrite() fallback
+#if defined(__linux__) && !defined(ASYNC_FILE_NO_IO_URING) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#define ASYNC_FILE_IO_URING 1
+#endif
+
+//Progress and outcome of work running on its own thread. The thread only ever
+//sees the job by reference and the destructor joins it, so dropping the last
+//shared_ptr to a running job waits for it instead of pulling memory from under it.
+class IoJob {
+    mutable std::mutex m;
+    std::condition_variable cv;
+    std::atomic<std::uint64_t> done{ 0 }, total{ 0 };
+    bool finished = false, succeeded = false;
+    std::vector<std::shared_ptr<void>> kept; //Released with the job, see retain()
+    std::thread worker;
+
+public:
+    IoJob() = default;
+    IoJob(const IoJob&) = delete;
+    IoJob& operator=(const IoJob&) = delete;
+    ~IoJob() { if (worker.joinable()) worker.join(); }
+
+    //Runs f(job) on a new thread, its bool result is what wait() returns
+    template <class F> void start(F f) {
+        worker = std::thread([this, f = std::move(f)]() mutable {
+            bool ok = false;
+            try { ok = f(*this); } catch (...) {}
+            std::lock_guard<std::mutex> lock(m);
+            finished = true;
+            succeeded = ok;
+            cv.notify_all();
+        });
+    }
+
+    //Progress in whatever unit the job counts, items for saves and loads
+    void setTotal(std::uint64_t n) { total.store(n, std::memory_order_relaxed); }
+    void advance(std::uint64_t n = 1) { done.fetch_add(n, std::memory_order_relaxed); }
+    std::uint64_t completed() const { return done.load(std::memory_order_relaxed); }
+    std::uint64_t expected() const { return total.load(std::memory_order_relaxed); }
+    double progress() const { //0 to 1
+        std::uint64_t t = expected();
+        return t ? std::min(1.0, (double)completed() / t) : (ready() ? 1.0 : 0.0);
+    }
+
+    bool ready() const { std::lock_guard<std::mutex> lock(m); return finished; }
+    bool wait() { //Blocks until the job is done, true if it succeeded
+        std::unique_lock<std::mutex> lock(m);
+        cv.wait(lock, [&] { return finished; });
+        return succeeded;
+    }
+    //Keeps p alive until the job is destroyed, for objects the job may still read
+    void retain(std::shared_ptr<void> p) { std::lock_guard<std::mutex> lock(m); kept.push_back(std::move(p)); }
+};
+
+#ifdef ASYNC_FILE_IO_URING
+//The smallest useful io_uring: one submitter, one waiter (the same thread), set up
+//with raw syscalls so no liburing is needed. Only vectored writes are submitted.
+class IoRing {
+    int ringFd = -1;
+    void* sqRing = MAP_FAILED; std::size_t sqRingSize = 0;
+    void* cqRing = MAP_FAILED; std::size_t cqRingSize = 0;
+    io_uring_sqe* sqes = (io_uring_sqe*)MAP_FAILED; std::size_t sqesSize = 0;
+    unsigned *sqTail = nullptr, *sqMask = nullptr, *sqArray = nullptr;
+    unsigned *cqHead = nullptr, *cqTail = nullptr, *cqMask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+
+    int enter(unsigned toSubmit, unsigned minComplete, unsigned flags) {
+        return (int)syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, nullptr, 0);
+    }
+    template <class T> static T* at(void* base, unsigned offset) { return (T*)((char*)base + offset); }
+
+public:
+    IoRing() = default;
+    IoRing(const IoRing&) = delete;
+    IoRing& operator=(const IoRing&) = delete;
+    ~IoRing() { close(); }
+
+    bool open(unsigned entries) { //False when the kernel does not offer io_uring to us
+        io_uring_params p;
+        std::memset(&p, 0, sizeof(p));
+        ringFd = (int)syscall(__NR_io_uring_setup, entries, &p);
+        if (ringFd < 0) return false;
+        sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+        if (sqRing == MAP_FAILED) { close(); return false; }
+        if (single) cqRing = sqRing;
+        else cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED) { close(); return false; }
+        sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+        sqes = (io_uring_sqe*)mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) { close(); return false; }
+        sqTail = at<unsigned>(sqRing, p.sq_off.tail);
+        sqMask = at<unsigned>(sqRing, p.sq_off.ring_mask);
+        sqArray = at<unsigned>(sqRing, p.sq_off.array);
+        cqHead = at<unsigned>(cqRing, p.cq_off.head);
+        cqTail = at<unsigned>(cqRing, p.cq_off.tail);
+        cqMask = at<unsigned>(cqRing, p.cq_off.ring_mask);
+        cqes = at<io_uring_cqe>(cqRing, p.cq_off.cqes);
+        return true;
+    }
+    void close() {
+        if (sqes != MAP_FAILED) munmap(sqes, sqesSize);
+        if (cqRing != MAP_FAILED && cqRing != sqRing) munmap(cqRing, cqRingSize);
+        if (sqRing != MAP_FAILED) munmap(sqRing, sqRingSize);
+        sqes = (io_uring_sqe*)MAP_FAILED; sqRing = cqRing = MAP_FAILED;
+        if (ringFd >= 0) ::close(ringFd);
+        ringFd = -1;
+    }
+
+    //iov has to stay untouched until the matching completion is reaped
+    bool submitWrite(int fd, const iovec* iov, std::uint64_t offset, std::uint64_t tag) {
+        unsigned tail = *sqTail, idx = tail & *sqMask;
+        io_uring_sqe& e = sqes[idx];
+        std::memset(&e, 0, sizeof(e));
+        e.opcode = IORING_OP_WRITEV;
+        e.fd = fd;
+        e.addr = (std::uint64_t)(std::uintptr_t)iov;
+        e.len = 1;
+        e.off = offset;
+        e.user_data = tag;
+        sqArray[idx] = idx;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        int r;
+        while ((r = enter(1, 0, 0)) < 0 && errno == EINTR) {}
+        return r == 1;
+    }
+    //Waits for one completion, res is the byte count or -errno
+    bool reap(std::uint64_t& tag, int& res) {
+        unsigned head = *cqHead;
+        while (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+            if (enter(0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) return false;
+        const io_uring_cqe& c = cqes[head & *cqMask];
+        tag = c.user_data;
+        res = c.res;
+        __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+};
+#endif
+
+//Sequential file writer with two large buffers: the caller fills one while the
+//other is being written, so serialization and disk writes overlap. Writes go
+//through io_uring where the kernel allows it and through a writer thread doing
+//pwrite() otherwise. Like OutputBuffer, formatters append to buffer() directly
+//and call commit() afterwards.
+class AsyncFileWriter {
+    struct Slot {
+        std::string data;
+        std::uint64_t offset = 0;
+        bool busy = false;  //Handed to the backend and not completed yet
+#ifdef ASYNC_FILE_IO_URING
+        iovec iov;
+#endif
+    };
+    Slot slots[2];
+    int current = 0;
+    int fd = -1;
+    std::size_t capacity;
+    std::uint64_t offset = 0;                   //File position of the start of buffer()
+    std::atomic<std::uint64_t> written{ 0 };
+    bool failed = false;
+    bool uring = false;                         //Backend chosen by open()
+#ifdef ASYNC_FILE_IO_URING
+    IoRing ring;
+#endif
+    //Fallback backend: one thread writing whatever slot it is handed
+    std::thread writer;
+    std::mutex m;
+    std::condition_variable cv;
+    unsigned queued = 0; //Bit per slot waiting for the writer
+    bool stopping = false;
+
+    static bool writeAt(int f, const char* p, std::size_t n, std::uint64_t off) {
+        while (n > 0) {
+            ssize_t w = ::pwrite(f, p, n, (off_t)off);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) return false;
+            p += w; n -= (std::size_t)w; off += (std::uint64_t)w;
+        }
+        return true;
+    }
+    void writerLoop() {
+        std::unique_lock<std::mutex> lock(m);
+        while (true) {
+            cv.wait(lock, [&] { return stopping || queued != 0; });
+            if (queued == 0) return;
+            Slot& s = slots[(queued & 1) ? 0 : 1];
+            queued &= ~(1u << (&s - slots));
+            lock.unlock();
+            bool ok = writeAt(fd, s.data.data(), s.data.size(), s.offset);
+            written.fetch_add(s.data.size(), std::memory_order_relaxed);
+            lock.lock();
+            if (!ok) failed = true;
+            s.busy = false;
+            cv.notify_all();
+        }
+    }
+    void submit(Slot& s) {
+        s.offset = offset;
+        offset += s.data.size();
+#ifdef ASYNC_FILE_IO_URING
+        if (uring) {
+            s.busy = true;
+            s.iov.iov_base = &s.data[0];
+            s.iov.iov_len = s.data.size();
+            if (!ring.submitWrite(fd, &s.iov, s.offset, (std::uint64_t)(&s - slots))) { //Write it here instead
+                s.busy = false;
+                if (writeAt(fd, s.data.data(), s.data.size(), s.offset)) written.fetch_add(s.data.size(), std::memory_order_relaxed);
+                else failed = true;
+            }
+            return;
+        }
+#endif
+        std::lock_guard<std::mutex> lock(m);
+        s.busy = true;
+        queued |= 1u << (&s - slots);
+        cv.notify_all();
+    }
+    void await(Slot& s) { //Waits until s may be refilled and empties it
+#ifdef ASYNC_FILE_IO_URING
+        if (uring) {
+            while (s.busy) {
+                std::uint64_t tag;
+                int res;
+                if (!ring.reap(tag, res)) { failed = true; s.busy = false; break; }
+                Slot& done = slots[tag & 1];
+                std::size_t n = res > 0 ? (std::size_t)res : 0;
+                written.fetch_add(n, std::memory_order_relaxed);
+                //Short write: the kernel took part of the buffer, write the rest directly
+                if (res < 0 || (n < done.data.size() && !writeAt(fd, done.data.data() + n, done.data.size() - n, done.offset + n)))
+                    failed = true;
+                else if (n < done.data.size())
+                    written.fetch_add(done.data.size() - n, std::memory_order_relaxed);
+                done.busy = false;
+            }
+        }
+#endif
+        if (!uring) {
+            std::unique_lock<std::mutex> lock(m);
+            cv.wait(lock, [&] { return !s.busy; });
+        }
+        s.data.clear();
+    }
+
+public:
+    explicit AsyncFileWriter(std::size_t bufferSize = 4 << 20) : capacity(bufferSize) {}
+    AsyncFileWriter(const AsyncFileWriter&) = delete;
+    AsyncFileWriter& operator=(const AsyncFileWriter&) = delete;
+    ~AsyncFileWriter() { close(); }
+
+    bool open(const std::string& path) { //Truncates path, prefers io_uring
+        close();
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return false;
+        offset = 0;
+        written = 0;
+        failed = false;
+        for (Slot& s : slots) { s.data.clear(); s.data.reserve(capacity + capacity / 8); }
+        current = 0;
+#ifdef ASYNC_FILE_IO_URING
+        uring = ring.open(4);
+        if (uring) return true;
+#endif
+        stopping = false;
+        queued = 0;
+        writer = std::thread([this] { writerLoop(); });
+        return true;
+    }
+    bool usesIoUring() const { return uring; }
+
+    std::string& buffer() { return slots[current].data; }
+    std::uint64_t position() const { return offset + slots[current].data.size(); } //Bytes handed over so far
+    std::uint64_t bytesWritten() const { return written.load(std::memory_order_relaxed); }
+
+    AsyncFileWriter& commit() { //Switches buffers once the current one is full
+        if (slots[current].data.size() >= capacity) flushBuffer();
+        return *this;
+    }
+    AsyncFileWriter& write(std::string_view s) { buffer().append(s.data(), s.size()); return commit(); }
+    void flushBuffer() { //Starts writing the current buffer, waits for the other one
+        Slot& s = slots[current];
+        if (s.data.empty() || fd < 0) return;
+        submit(s);
+        current ^= 1;
+        await(slots[current]);
+    }
+
+    //Writes what is left and waits for it, false if any write failed
+    bool close() {
+        if (fd < 0) return !failed;
+        flushBuffer();
+        await(slots[0]);
+        await(slots[1]);
+#ifdef ASYNC_FILE_IO_URING
+        if (uring) ring.close();
+#endif
+        uring = false;
+        if (writer.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(m);
+                stopping = true;
+            }
+            cv.notify_all();
+            writer.join();
+        }
+        if (::close(fd) != 0) failed = true;
+        fd = -1;
+        return !failed;
+    }
+};
+
+#endif
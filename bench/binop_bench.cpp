@@ -0,0 +1,144 @@
+//BinOp::evaluate (plain and through ResultCache), batch and formula evaluation and streaming pipeline throughput, binOp2.cpp
+#define BINOP2_NO_MAIN
+#include "../binOp2.cpp"
+#include "synthetic.h"
+
+#include <sstream>
+
+namespace {
+
+//n well-formed expressions over all four operators, never dividing by zero
+void makeExpressions(std::size_t n, std::vector<double>& a, std::vector<char>& ops, std::vector<double>& b) {
+    static const char OPS[] = { '+', '-', '*', '/' };
+    a.resize(n); ops.resize(n); b.resize(n);
+    std::size_t i = 0;
+    forEachSyntheticItem(n, [&](const SyntheticItem& s) {
+        a[i] = s.price;
+        ops[i] = OPS[(i + s.number) % 4];
+        b[i] = s.number + 1.5;
+        ++i;
+    });
+}
+
+void setRates(benchmark::State& state, int64_t bytesPerRow) {
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.SetBytesProcessed(state.iterations() * state.range(0) * bytesPerRow);
+}
+
+void BM_BinOpEvaluate(benchmark::State& state) {
+    std::vector<double> a, b;
+    std::vector<char> ops;
+    makeExpressions(state.range(0), a, ops, b);
+    std::vector<BinOp> exprs;
+    exprs.reserve(a.size());
+    for (std::size_t i = 0; i < a.size(); ++i) exprs.emplace_back(a[i], ops[i], b[i]);
+    for (auto _ : state) {
+        double sum = 0;
+        for (const auto& e : exprs) sum += e.evaluate();
+        benchmark::DoNotOptimize(sum);
+    }
+    setRates(state, sizeof(BinOp));
+}
+
+//n rows drawn from n / 16 distinct expressions, one in eight of them dividing by zero
+std::vector<BinOp> makeRepeated(std::size_t n) {
+    std::vector<double> a, b;
+    std::vector<char> ops;
+    std::size_t distinct = std::max<std::size_t>(1, n / 16);
+    makeExpressions(distinct, a, ops, b);
+    for (std::size_t i = 0; i < distinct; i += 8) { ops[i] = '/'; b[i] = 0; }
+    std::vector<BinOp> exprs;
+    exprs.reserve(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        std::size_t k = (i * 7919) % distinct;
+        exprs.emplace_back(a[k], ops[k], b[k]);
+    }
+    return exprs;
+}
+
+void BM_BinOpRepeated(benchmark::State& state) {
+    std::vector<BinOp> exprs = makeRepeated(state.range(0));
+    for (auto _ : state) {
+        double sum = 0;
+        for (const auto& e : exprs) {
+            try { sum += e.evaluate(); } catch (const std::exception&) {}
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    setRates(state, sizeof(BinOp));
+}
+
+//Same rows through a cache large enough for every distinct expression
+void BM_BinOpRepeatedCached(benchmark::State& state) {
+    std::vector<BinOp> exprs = makeRepeated(state.range(0));
+    ResultCache cache(std::max<std::size_t>(1024, state.range(0) / 8));
+    for (auto _ : state) {
+        double sum = 0, r;
+        for (const auto& e : exprs) if (e.evaluate(cache, r) == EVAL_OK) sum += r;
+        benchmark::DoNotOptimize(sum);
+    }
+    setRates(state, sizeof(BinOp));
+    state.counters["hit_rate"] = (double)cache.hits() / std::max<std::uint64_t>(1, cache.hits() + cache.misses());
+}
+
+void BM_BatchEvaluate(benchmark::State& state) {
+    std::vector<double> a, b;
+    std::vector<char> ops;
+    makeExpressions(state.range(0), a, ops, b);
+    std::vector<double> results(a.size());
+    std::vector<unsigned char> status(a.size());
+    for (auto _ : state) {
+        BatchEvaluator::evaluate(a.data(), ops.data(), b.data(), results.data(), status.data(), a.size());
+        benchmark::DoNotOptimize(results.data());
+    }
+    setRates(state, 2 * sizeof(double) + sizeof(char));
+}
+
+//Compiled formula over columns of bindings, rows/s counts whole formula evaluations
+void BM_FormulaColumns(benchmark::State& state) {
+    std::vector<double> a, b;
+    std::vector<char> ops;
+    makeExpressions(state.range(0), a, ops, b);
+    Formula f;
+    f.compile("x * (1 + y) - x / y");
+    const double* columns[] = { a.data(), b.data() };
+    std::vector<double> results(a.size());
+    std::vector<unsigned char> status(a.size());
+    for (auto _ : state) {
+        f.evaluate(columns, results.data(), status.data(), a.size());
+        benchmark::DoNotOptimize(results.data());
+    }
+    setRates(state, 2 * sizeof(double));
+}
+
+//Text in, text out, as binOp2 <input> <output> does it
+void BM_Pipeline(benchmark::State& state) {
+    std::vector<double> a, b;
+    std::vector<char> ops;
+    makeExpressions(state.range(0), a, ops, b);
+    std::string input;
+    for (std::size_t i = 0; i < a.size(); ++i) {
+        appendNumber(input, a[i]);
+        input += ' '; input += ops[i]; input += ' ';
+        appendNumber(input, b[i]);
+        input += '\n';
+    }
+    for (auto _ : state) {
+        std::istringstream in(input);
+        std::ostringstream out;
+        benchmark::DoNotOptimize(runPipeline(in, out).rows);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.SetBytesProcessed(state.iterations() * (int64_t)input.size());
+}
+
+}
+
+BENCHMARK(BM_BinOpEvaluate)->Apply(catalogSizes);
+BENCHMARK(BM_BinOpRepeated)->Apply(catalogSizes);
+BENCHMARK(BM_BinOpRepeatedCached)->Apply(catalogSizes);
+BENCHMARK(BM_BatchEvaluate)->Apply(catalogSizes);
+BENCHMARK(BM_FormulaColumns)->Apply(catalogSizes);
+BENCHMARK(BM_Pipeline)->Apply(catalogSizes)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,164 @@
+//Container save/load (plain and compressed), option-6 listing, report, expiry lookup and external sort throughput, shopping_items_updated.cpp
+#define SHOPPING_ITEMS_UPDATED_NO_MAIN
+#include "../shopping_items_updated.cpp"
+#include "synthetic.h"
+
+#include <cstdio>
+#include <streambuf>
+
+namespace {
+
+const char* BENCH_FILE = "bench_items.bin";
+
+Container makeContainer(size_t n) {
+    Container c;
+    forEachSyntheticItem(n, [&](const SyntheticItem& s) {
+        switch (s.kind) {
+            case 0: c.emplace<Grocery>(s.name, s.price, s.text); break;
+            case 1: c.emplace<Electronics>(s.name, s.price, s.number); break;
+            case 2: c.emplace<Clothing>(s.name, s.price, s.text); break;
+            case 3: c.emplace<Book>(s.name, s.price, s.text); break;
+            default: c.emplace<Toy>(s.name, s.price, s.number); break;
+        }
+    });
+    return c;
+}
+
+int64_t fileSize(const char* file) {
+    ifstream ifs(file, ios::binary | ios::ate);
+    return ifs ? (int64_t)ifs.tellg() : 0;
+}
+
+void setRates(benchmark::State& state, int64_t bytesPerIteration) {
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.SetBytesProcessed(state.iterations() * bytesPerIteration);
+}
+
+//Swallows the listing and counts its bytes
+class CountingBuf : public streambuf {
+public:
+    int64_t bytes = 0;
+protected:
+    int overflow(int ch) override { ++bytes; return ch; }
+    streamsize xsputn(const char*, streamsize n) override { bytes += n; return n; }
+};
+
+void BM_SaveBinary(benchmark::State& state) {
+    Container c = makeContainer(state.range(0));
+    for (auto _ : state) c.saveBinary(BENCH_FILE);
+    setRates(state, fileSize(BENCH_FILE));
+    remove(BENCH_FILE);
+}
+
+void BM_LoadBinary(benchmark::State& state) {
+    makeContainer(state.range(0)).saveBinary(BENCH_FILE);
+    Container c;
+    for (auto _ : state) {
+        c.loadBinary(BENCH_FILE);
+        benchmark::DoNotOptimize(c.size());
+    }
+    setRates(state, fileSize(BENCH_FILE));
+    remove(BENCH_FILE);
+}
+
+//Compressed blocks, bytes are the file's compressed size and "ratio" is plain / compressed
+void BM_SaveBinaryCompressed(benchmark::State& state) {
+    Container c = makeContainer(state.range(0));
+    for (auto _ : state) c.saveBinary(BENCH_FILE, BinaryFormat::Compressed);
+    setRates(state, fileSize(BENCH_FILE));
+    int64_t packed = fileSize(BENCH_FILE);
+    c.saveBinary(BENCH_FILE);
+    state.counters["ratio"] = (double)fileSize(BENCH_FILE) / max<int64_t>(packed, 1);
+    remove(BENCH_FILE);
+}
+
+void BM_LoadBinaryCompressed(benchmark::State& state) {
+    makeContainer(state.range(0)).saveBinary(BENCH_FILE, BinaryFormat::Compressed);
+    Container c;
+    for (auto _ : state) {
+        c.loadBinary(BENCH_FILE);
+        benchmark::DoNotOptimize(c.size());
+    }
+    setRates(state, fileSize(BENCH_FILE));
+    remove(BENCH_FILE);
+}
+
+//Partial read of 1000 records from the middle, only their blocks are decompressed
+void BM_CompressedSeek(benchmark::State& state) {
+    makeContainer(state.range(0)).saveBinary(BENCH_FILE, BinaryFormat::Compressed);
+    CompressedCatalog cat;
+    cat.open(BENCH_FILE);
+    double sum = 0;
+    for (auto _ : state) {
+        cat.read(cat.size() / 2, 1000, [&](const ItemView& v) { sum += v.price; });
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * 1000);
+    remove(BENCH_FILE);
+}
+
+//Option 6 of the menu: showAll() and then every item in descending price order
+void BM_PriorityListing(benchmark::State& state) {
+    Container c = makeContainer(state.range(0));
+    CountingBuf sink;
+    ostream os(&sink);
+    OutputBuffer out(os);
+    for (auto _ : state) {
+        c.showAll(out);
+        c.showByPrice(out);
+    }
+    state.SetItemsProcessed(2 * state.iterations() * state.range(0));
+    state.SetBytesProcessed(sink.bytes);
+}
+
+//Parallel report over the struct-of-arrays store, one pool thread per core
+void BM_ReportStore(benchmark::State& state) {
+    Container c = makeContainer(state.range(0));
+    ItemStore store;
+    store.reserve(c.size());
+    for (const auto& i : c.getItems()) store.add(*i);
+    WorkerPool pool;
+    ReportEngine engine(pool);
+    ReportOptions opt;
+    opt.expiryBefore = "2026-07-01";
+    for (auto _ : state) benchmark::DoNotOptimize(engine.run(store, opt).groceriesExpiringBefore);
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.SetBytesProcessed(state.iterations() * state.range(0) * (int64_t)(sizeof(double) + sizeof(ItemKind)));
+}
+
+//Groceries expiring in January from the expiry index, items/s counts the matches
+void BM_ExpiringBefore(benchmark::State& state) {
+    Container c = makeContainer(state.range(0));
+    Date cutoff(2026, 2, 1);
+    int64_t found = 0;
+    for (auto _ : state) c.expiringBefore(cutoff, [&](const Item&) { ++found; });
+    state.SetItemsProcessed(found);
+}
+
+//Out-of-core price sort of items.bin with a budget of a quarter of the file, so it spills and merges
+void BM_ExternalSort(benchmark::State& state) {
+    makeContainer(state.range(0)).saveBinary(BENCH_FILE);
+    ExternalSortOptions opt;
+    opt.memoryBudget = max<size_t>(1 << 20, (size_t)fileSize(BENCH_FILE) / 4);
+    for (auto _ : state) {
+        ExternalSort sorter(opt);
+        benchmark::DoNotOptimize(sorter.sortFile(BENCH_FILE, "bench_sorted.bin"));
+    }
+    setRates(state, fileSize(BENCH_FILE));
+    remove(BENCH_FILE);
+    remove("bench_sorted.bin");
+}
+
+}
+
+BENCHMARK(BM_SaveBinary)->Apply(catalogSizes)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_LoadBinary)->Apply(catalogSizes)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_SaveBinaryCompressed)->Apply(catalogSizes)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_LoadBinaryCompressed)->Apply(catalogSizes)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_CompressedSeek)->Apply(catalogSizes)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_PriorityListing)->Apply(catalogSizes)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_ReportStore)->Apply(catalogSizes)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_ExpiringBefore)->Apply(catalogSizes)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_ExternalSort)->Apply(catalogSizes)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,43 @@
+//restore() throughput over a generated items.txt, shopping_items.cpp
+#define SHOPPING_ITEMS_NO_MAIN
+#include "../shopping_items.cpp"
+#include "synthetic.h"
+
+#include <cstdio>
+
+namespace {
+
+const char* BENCH_FILE = "bench_items.txt";
+
+//Writes n items in the same format persist() uses and returns the file size
+int64_t writeCatalog(size_t n) {
+    ofstream ofs(BENCH_FILE);
+    forEachSyntheticItem(n, [&](const SyntheticItem& s) {
+        switch (s.kind) {
+            case 0: Grocery(s.name, s.price, s.text).persist(ofs); break;
+            case 1: Electronics(s.name, s.price, s.number).persist(ofs); break;
+            case 2: Clothing(s.name, s.price, s.text).persist(ofs); break;
+            case 3: Book(s.name, s.price, s.text).persist(ofs); break;
+            default: Toy(s.name, s.price, s.number).persist(ofs); break;
+        }
+    });
+    return (int64_t)ofs.tellp();
+}
+
+void BM_Restore(benchmark::State& state) {
+    int64_t bytes = writeCatalog(state.range(0));
+    for (auto _ : state) {
+        ItemArena arena;
+        vector<Item*> items = restore(BENCH_FILE, arena);
+        benchmark::DoNotOptimize(items.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.SetBytesProcessed(state.iterations() * bytes);
+    remove(BENCH_FILE);
+}
+
+}
+
+BENCHMARK(BM_Restore)->Apply(catalogSizes)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+BENCHMARK_MAIN();
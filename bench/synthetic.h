@@ -0,0 +1,58 @@
+#ifndef BENCH_SYNTHETIC_H
+#define BENCH_SYNTHETIC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <benchmark/benchmark.h>
+
+#ifndef OOP_LABS_BENCH_MAX_ITEMS
+#define OOP_LABS_BENCH_MAX_ITEMS 1000000
+#endif
+
+//One generated item. kind is 0..4 for Grocery, Electronics, Clothing, Book and Toy,
+//text is used by Grocery/Clothing/Book and number by Electronics/Toy.
+struct SyntheticItem {
+    int kind;
+    std::string name;
+    double price;
+    std::string text;
+    int number;
+};
+
+//Deterministic catalog of n items spread evenly over the five kinds, so every run
+//of a benchmark sees the same data
+template <class F> void forEachSyntheticItem(std::size_t n, F f) {
+    static const char* sizes[] = { "XS", "S", "M", "L", "XL" };
+    static const char* authors[] = { "Austen", "Tolkien", "Orwell", "Herbert", "Le Guin", "Pratchett" };
+    std::uint64_t state = 0x9E3779B97F4A7C15ull;
+    SyntheticItem item;
+    for (std::size_t i = 0; i < n; ++i) {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        std::uint32_t r = (std::uint32_t)(state >> 33);
+        item.kind = (int)(i % 5);
+        item.name = "item" + std::to_string(i);
+        item.price = (r % 100000) / 100.0;
+        item.number = (int)(r % 18);
+        switch (item.kind) {
+            case 0: {
+                char date[11];
+                std::snprintf(date, sizeof(date), "2026-%02u-%02u", 1 + r % 12, 1 + r % 28);
+                item.text = date;
+                break;
+            }
+            case 2: item.text = sizes[r % 5]; break;
+            case 3: item.text = authors[r % 6]; break;
+            default: item.text.clear(); break;
+        }
+        f(item);
+    }
+}
+
+//Catalog sizes 10^3, 10^4, ... up to OOP_LABS_BENCH_MAX_ITEMS
+inline void catalogSizes(benchmark::internal::Benchmark* b) {
+    for (long long n = 1000; n <= (long long)OOP_LABS_BENCH_MAX_ITEMS; n *= 10) b->Arg(n);
+}
+
+#endif
@@ -1,7 +1,29 @@
 #include <iostream>
 #include <fstream>
 #include <stdexcept>
-#include <sstream>
+#include <string>
+#include <string_view>
+#include <charconv>
+#include <cctype>
+#include <deque>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include "worker_pool.h"
+#include "output_buffer.h"
+#include "metrics.h"
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BINOP_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+class ResultCache;
 
 class BinOp {
 private:
@@ -24,68 +46,815 @@ public:
 
     //Evaluate the expression for all operator cases
     double evaluate() const {
+        METRIC_TIMER("binop_evaluate");
         switch(oprtr) {
             case '+': return operand1 + operand2;
             case '-': return operand1 - operand2;
             case '*': return operand1 * operand2;
             case '/':
-                if(operand2 == 0) throw std::runtime_error("Division by zero"); //Undefined
+                if(operand2 == 0) { METRIC_COUNT("evaluation_exceptions", 1); throw std::runtime_error("Division by zero"); } //Undefined
                 return operand1 / operand2;
-            default: throw std::runtime_error("Invalid operator"); //Not +, -, *, / so raise error. 
+            default: METRIC_COUNT("evaluation_exceptions", 1); throw std::runtime_error("Invalid operator"); //Not +, -, *, / so raise error. 
+        }
+    }
+    //Same outcome looked up in (or added to) cache, as an EvalStatus instead of an exception.
+    //result is NaN on errors.
+    unsigned char evaluate(ResultCache& cache, double& result) const;
+};
+
+
+//Per-row outcome written by BatchEvaluator instead of throwing
+enum EvalStatus : unsigned char { EVAL_OK = 0, EVAL_DIVISION_BY_ZERO = 1, EVAL_INVALID_OPERATOR = 2 };
+
+inline const char* evalStatusMessage(unsigned char status) { //Same wording as BinOp::evaluate
+    switch (status) {
+        case EVAL_OK: return "";
+        case EVAL_DIVISION_BY_ZERO: return "Division by zero";
+        default: return "Invalid operator";
+    }
+}
+
+//Bounded memo of "a op b" outcomes, errors included, so a repeated expression is a
+//lookup and a repeated bad one never reaches the exception path. Keys are spread
+//over shards, each an open-addressing table (linear probing, at most half full)
+//behind its own mutex. A full shard evicts with CLOCK: the hand sweeps the slots,
+//giving each entry hit since the last sweep a second chance.
+class ResultCache {
+    struct Slot {
+        double a, b, result;
+        std::uint32_t hash;
+        char op;
+        unsigned char status;
+        bool used = false, referenced = false;
+    };
+    struct alignas(64) Shard { //Own cache line, so shards do not contend for the mutex's line
+        std::mutex m;
+        std::vector<Slot> slots; //Power of two long
+        std::size_t size = 0, hand = 0;
+        std::uint64_t hits = 0, misses = 0;
+    };
+    std::unique_ptr<Shard[]> shards;
+    std::size_t shardCount = 1, perShard = 1; //perShard is the entry limit of one shard
+
+    static std::uint64_t hashOf(double a, char op, double b) {
+        std::uint64_t x, y;
+        std::memcpy(&x, &a, 8); std::memcpy(&y, &b, 8);
+        std::uint64_t h = x * 0x9E3779B97F4A7C15ull ^ (y ^ (unsigned char)op) * 0xC2B2AE3D27D4EB4Full;
+        h ^= h >> 29; h *= 0xBF58476D1CE4E5B9ull; h ^= h >> 32;
+        return h;
+    }
+    static bool same(double x, double y) { return std::memcmp(&x, &y, sizeof(x)) == 0; } //Bitwise, so -0 and NaN keys work
+    static std::size_t roundUp(std::size_t n) { std::size_t p = 1; while (p < n) p <<= 1; return p; }
+
+    //Slot holding the key, or the free slot where it would go
+    static Slot& probe(Shard& s, std::uint32_t h, double a, char op, double b) {
+        std::size_t mask = s.slots.size() - 1;
+        for (std::size_t i = h & mask;; i = (i + 1) & mask) {
+            Slot& e = s.slots[i];
+            if (!e.used || (e.hash == h && e.op == op && same(e.a, a) && same(e.b, b))) return e;
+        }
+    }
+    static void erase(Shard& s, std::size_t i) { //Backward shift, later entries of the probe run close the gap
+        std::size_t mask = s.slots.size() - 1;
+        for (std::size_t j = (i + 1) & mask; s.slots[j].used; j = (j + 1) & mask) {
+            std::size_t home = s.slots[j].hash & mask;
+            if (((j - home) & mask) >= ((j - i) & mask)) { s.slots[i] = s.slots[j]; i = j; } //Its home is not in (i, j]
+        }
+        s.slots[i].used = false;
+        --s.size;
+    }
+    static void evict(Shard& s) {
+        std::size_t mask = s.slots.size() - 1;
+        while (true) {
+            std::size_t i = s.hand;
+            s.hand = (s.hand + 1) & mask;
+            Slot& e = s.slots[i];
+            if (!e.used) continue;
+            if (e.referenced) { e.referenced = false; continue; }
+            erase(s, i);
+            return;
+        }
+    }
+    void store(Shard& s, std::uint32_t h, double a, char op, double b, double result, unsigned char status) {
+        Slot* e = &probe(s, h, a, op, b);
+        if (!e->used && s.size == perShard) { //Full, the eviction may move the free slot
+            evict(s);
+            e = &probe(s, h, a, op, b);
+        }
+        if (!e->used) { ++s.size; e->referenced = false; } //Only a hit earns a second chance
+        e->a = a; e->op = op; e->b = b; e->hash = h;
+        e->result = result; e->status = status; e->used = true;
+    }
+    Shard& shardOf(std::uint64_t h) { return shards[(h >> 48) & (shardCount - 1)]; }
+    template <class T> std::uint64_t sum(T Shard::*field) {
+        std::uint64_t total = 0;
+        for (std::size_t i = 0; i < shardCount; ++i) {
+            std::lock_guard<std::mutex> lock(shards[i].m);
+            total += shards[i].*field;
+        }
+        return total;
+    }
+
+public:
+    //Holds about capacity entries in total, shards is rounded up to a power of two
+    explicit ResultCache(std::size_t capacity = 1 << 16, unsigned shardHint = 16) {
+        shardCount = roundUp(std::max(1u, shardHint));
+        perShard = std::max<std::size_t>(1, capacity / shardCount);
+        shards.reset(new Shard[shardCount]);
+        for (std::size_t i = 0; i < shardCount; ++i) shards[i].slots.resize(2 * roundUp(perShard));
+    }
+
+    //The EvalStatus of a op b, computed and remembered on a miss. result is NaN on errors.
+    unsigned char evaluate(double a, char op, double b, double& result) {
+        std::uint64_t h = hashOf(a, op, b);
+        Shard& s = shardOf(h);
+        std::lock_guard<std::mutex> lock(s.m);
+        Slot& e = probe(s, (std::uint32_t)h, a, op, b);
+        if (e.used) {
+            ++s.hits;
+            e.referenced = true;
+            result = e.result;
+            return e.status;
+        }
+        ++s.misses;
+        unsigned char status = EVAL_OK;
+        switch (op) { //BinOp::evaluate without the exceptions
+            case '+': result = a + b; break;
+            case '-': result = a - b; break;
+            case '*': result = a * b; break;
+            case '/': if (b == 0) status = EVAL_DIVISION_BY_ZERO; else result = a / b; break;
+            default: status = EVAL_INVALID_OPERATOR;
+        }
+        if (status != EVAL_OK) result = std::numeric_limits<double>::quiet_NaN();
+        store(s, (std::uint32_t)h, a, op, b, result, status);
+        return status;
+    }
+    //Lookup only, for callers that evaluate misses themselves and insert() them
+    bool find(double a, char op, double b, double& result, unsigned char& status) {
+        std::uint64_t h = hashOf(a, op, b);
+        Shard& s = shardOf(h);
+        std::lock_guard<std::mutex> lock(s.m);
+        Slot& e = probe(s, (std::uint32_t)h, a, op, b);
+        if (!e.used) { ++s.misses; return false; }
+        ++s.hits;
+        e.referenced = true;
+        result = e.result;
+        status = e.status;
+        return true;
+    }
+    void insert(double a, char op, double b, double result, unsigned char status) {
+        std::uint64_t h = hashOf(a, op, b);
+        Shard& s = shardOf(h);
+        std::lock_guard<std::mutex> lock(s.m);
+        store(s, (std::uint32_t)h, a, op, b, result, status);
+    }
+
+    std::uint64_t hits() { return sum(&Shard::hits); }
+    std::uint64_t misses() { return sum(&Shard::misses); }
+    std::size_t size() { return (std::size_t)sum(&Shard::size); }
+    std::size_t capacity() const { return shardCount * perShard; }
+};
+
+inline unsigned char BinOp::evaluate(ResultCache& cache, double& result) const { return cache.evaluate(operand1, oprtr, operand2, result); }
+
+//Evaluates many expressions at once. Rows are grouped by operator and each
+//group runs through a vectorised kernel (AVX2 or SSE2 when the CPU has them,
+//plain loop otherwise). Errors never throw, they are reported per row.
+class BatchEvaluator {
+    typedef void (*Kernel)(const double*, const double*, double*, unsigned char*, std::size_t);
+    static constexpr std::size_t BLOCK = 4096; //Rows grouped at a time, keeps the scratch buffers in cache
+
+    template <char Op> static double apply(double x, double y) {
+        return Op == '+' ? x + y : Op == '-' ? x - y : Op == '*' ? x * y : x / y;
+    }
+    template <char Op> static void scalarKernel(const double* a, const double* b, double* r, unsigned char* st, std::size_t n) {
+        for (std::size_t i = 0; i < n; ++i) {
+            bool divZero = Op == '/' && b[i] == 0;
+            r[i] = divZero ? std::numeric_limits<double>::quiet_NaN() : apply<Op>(a[i], b[i]);
+            st[i] = divZero ? EVAL_DIVISION_BY_ZERO : EVAL_OK;
+        }
+    }
+#ifdef BINOP_X86_KERNELS
+    template <char Op> __attribute__((target("sse2")))
+    static void sse2Kernel(const double* a, const double* b, double* r, unsigned char* st, std::size_t n) {
+        std::size_t i = 0;
+        const __m128d nan = _mm_set1_pd(std::numeric_limits<double>::quiet_NaN());
+        for (; i + 2 <= n; i += 2) {
+            __m128d x = _mm_loadu_pd(a + i), y = _mm_loadu_pd(b + i), v;
+            if (Op == '+') v = _mm_add_pd(x, y);
+            else if (Op == '-') v = _mm_sub_pd(x, y);
+            else if (Op == '*') v = _mm_mul_pd(x, y);
+            else v = _mm_div_pd(x, y);
+            int zeroMask = 0;
+            if (Op == '/') {
+                __m128d zero = _mm_cmpeq_pd(y, _mm_setzero_pd());
+                v = _mm_or_pd(_mm_and_pd(zero, nan), _mm_andnot_pd(zero, v));
+                zeroMask = _mm_movemask_pd(zero);
+            }
+            _mm_storeu_pd(r + i, v);
+            st[i] = (zeroMask & 1) ? EVAL_DIVISION_BY_ZERO : EVAL_OK;
+            st[i + 1] = (zeroMask & 2) ? EVAL_DIVISION_BY_ZERO : EVAL_OK;
+        }
+        scalarKernel<Op>(a + i, b + i, r + i, st + i, n - i);
+    }
+    template <char Op> __attribute__((target("avx2")))
+    static void avx2Kernel(const double* a, const double* b, double* r, unsigned char* st, std::size_t n) {
+        std::size_t i = 0;
+        const __m256d nan = _mm256_set1_pd(std::numeric_limits<double>::quiet_NaN());
+        for (; i + 4 <= n; i += 4) {
+            __m256d x = _mm256_loadu_pd(a + i), y = _mm256_loadu_pd(b + i), v;
+            if (Op == '+') v = _mm256_add_pd(x, y);
+            else if (Op == '-') v = _mm256_sub_pd(x, y);
+            else if (Op == '*') v = _mm256_mul_pd(x, y);
+            else v = _mm256_div_pd(x, y);
+            int zeroMask = 0;
+            if (Op == '/') {
+                __m256d zero = _mm256_cmp_pd(y, _mm256_setzero_pd(), _CMP_EQ_OQ);
+                v = _mm256_blendv_pd(v, nan, zero);
+                zeroMask = _mm256_movemask_pd(zero);
+            }
+            _mm256_storeu_pd(r + i, v);
+            for (int j = 0; j < 4; ++j) st[i + j] = ((zeroMask >> j) & 1) ? EVAL_DIVISION_BY_ZERO : EVAL_OK;
+        }
+        scalarKernel<Op>(a + i, b + i, r + i, st + i, n - i);
+    }
+#endif
+    //Kernels for + - * / picked once for the CPU we are running on
+    static const Kernel* kernels() {
+        static const Kernel* table = [] {
+#ifdef BINOP_X86_KERNELS
+            static const Kernel avx2[4] = { avx2Kernel<'+'>, avx2Kernel<'-'>, avx2Kernel<'*'>, avx2Kernel<'/'> };
+            static const Kernel sse2[4] = { sse2Kernel<'+'>, sse2Kernel<'-'>, sse2Kernel<'*'>, sse2Kernel<'/'> };
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2")) return avx2;
+            if (__builtin_cpu_supports("sse2")) return sse2;
+#endif
+            static const Kernel scalar[4] = { scalarKernel<'+'>, scalarKernel<'-'>, scalarKernel<'*'>, scalarKernel<'/'> };
+            return scalar;
+        }();
+        return table;
+    }
+    static int slotOf(char op) { //0..3 for + - * /, 4 for anything else
+        switch (op) {
+            case '+': return 0;
+            case '-': return 1;
+            case '*': return 2;
+            case '/': return 3;
+            default: return 4;
+        }
+    }
+
+public:
+    //r[i] = a[i] op b[i] for one operator (+ - * /) through the kernel picked for this CPU
+    static void evaluateColumn(char op, const double* a, const double* b, double* r, unsigned char* status, std::size_t n) {
+        kernels()[slotOf(op)](a, b, r, status, n);
+    }
+
+    //Evaluates a[i] ops[i] b[i] into results[i] for n rows, status[i] gets an EvalStatus.
+    //Rows that fail get a NaN result.
+    static void evaluate(const double* a, const char* ops, const double* b, double* results, unsigned char* status, std::size_t n) {
+        const Kernel* k = kernels();
+        std::vector<std::uint32_t> order(BLOCK);
+        std::vector<double> ga(BLOCK), gb(BLOCK), gr(BLOCK);
+        std::vector<unsigned char> gs(BLOCK);
+        for (std::size_t base = 0; base < n; base += BLOCK) {
+            std::size_t m = std::min(BLOCK, n - base);
+            const char* op = ops + base;
+
+            //Counting sort of the block's rows by operator
+            std::size_t start[6] = {};
+            for (std::size_t i = 0; i < m; ++i) ++start[slotOf(op[i]) + 1];
+            for (int s = 0; s < 5; ++s) start[s + 1] += start[s];
+            if (start[1] == m || start[2] - start[1] == m || start[3] - start[2] == m || start[4] - start[3] == m) {
+                int s = slotOf(op[0]); //Whole block uses one operator, no gathering needed
+                k[s](a + base, b + base, results + base, status + base, m);
+                continue;
+            }
+            std::size_t fill[5] = { start[0], start[1], start[2], start[3], start[4] };
+            for (std::size_t i = 0; i < m; ++i) order[fill[slotOf(op[i])]++] = (std::uint32_t)i;
+
+            for (int s = 0; s < 4; ++s) {
+                std::size_t from = start[s], count = start[s + 1] - start[s];
+                if (count == 0) continue;
+                for (std::size_t j = 0; j < count; ++j) {
+                    std::size_t row = base + order[from + j];
+                    ga[j] = a[row]; gb[j] = b[row];
+                }
+                k[s](ga.data(), gb.data(), gr.data(), gs.data(), count);
+                for (std::size_t j = 0; j < count; ++j) {
+                    std::size_t row = base + order[from + j];
+                    results[row] = gr[j]; status[row] = gs[j];
+                }
+            }
+            for (std::size_t j = start[4]; j < start[5]; ++j) {
+                results[base + order[j]] = std::numeric_limits<double>::quiet_NaN();
+                status[base + order[j]] = EVAL_INVALID_OPERATOR;
+            }
         }
     }
 };
 
 
+//Arithmetic over named variables, e.g. "price * (1 + tax) - discount / 2". compile()
+//parses the text once, with the usual precedence and parentheses, into postfix
+//bytecode. evaluate() then runs that bytecode for one row or over whole columns of
+//variable bindings, so the parse cost is paid once per formula instead of per row.
+class Formula {
+public:
+    static constexpr std::size_t MAX_DEPTH = 64; //Deepest operand stack a formula may use
+
+private:
+    enum Code : unsigned char { PUSH_CONST, PUSH_VAR, ADD, SUB, MUL, DIV, NEG };
+    struct Instr {
+        Code code;
+        std::uint32_t arg; //Index into constants or variables for the pushes
+    };
+    static constexpr std::size_t BLOCK = 4096; //Rows per column pass, keeps the operand stack in cache
+    std::vector<Instr> program;
+    std::vector<double> constants;
+    std::vector<std::string> variables;
+    std::size_t depth = 0;
+
+    static char opChar(Code c) { return c == ADD ? '+' : c == SUB ? '-' : c == MUL ? '*' : '/'; }
+
+    //Recursive descent over expr := term (+|- term)*, term := unary (*|/ unary)*,
+    //unary := (+|-) unary | number | name | ( expr )
+    struct Parser {
+        Formula& f;
+        const char* first;
+        const char* start;
+        const char* last;
+        std::string error;
+        std::size_t stack = 0;
+        std::size_t nesting = 0; //Bounds the recursion on inputs like "((((..."
+
+        void skipSpace() { while (first != last && (*first == ' ' || *first == '\t' || *first == '\r')) ++first; }
+        bool fail(const char* what) {
+            if (error.empty()) error = std::string(what) + " at column " + std::to_string(first - start + 1);
+            return false;
+        }
+        void push(Code c, std::uint32_t arg) {
+            f.program.push_back({ c, arg });
+            f.depth = std::max(f.depth, ++stack);
+        }
+        void emit(Code c) { //Folds operations on constants as it goes
+            std::vector<Instr>& p = f.program;
+            std::size_t n = p.size();
+            if (c == NEG) {
+                if (p[n - 1].code == PUSH_CONST) f.constants[p[n - 1].arg] = -f.constants[p[n - 1].arg];
+                else p.push_back({ NEG, 0 });
+                return;
+            }
+            --stack;
+            if (p[n - 2].code == PUSH_CONST && p[n - 1].code == PUSH_CONST && !(c == DIV && f.constants[p[n - 1].arg] == 0)) {
+                double& a = f.constants[p[n - 2].arg];
+                double b = f.constants[p[n - 1].arg];
+                a = c == ADD ? a + b : c == SUB ? a - b : c == MUL ? a * b : a / b;
+                p.pop_back();
+                return;
+            }
+            p.push_back({ c, 0 });
+        }
+        bool expr() {
+            if (!term()) return false;
+            while (skipSpace(), first != last && (*first == '+' || *first == '-')) {
+                Code c = *first++ == '+' ? ADD : SUB;
+                if (!term()) return false;
+                emit(c);
+            }
+            return true;
+        }
+        bool term() {
+            if (!unary()) return false;
+            while (skipSpace(), first != last && (*first == '*' || *first == '/')) {
+                Code c = *first++ == '*' ? MUL : DIV;
+                if (!unary()) return false;
+                emit(c);
+            }
+            return true;
+        }
+        bool unary() {
+            if (nesting == 4 * MAX_DEPTH) return fail("formula nests too deeply");
+            ++nesting;
+            skipSpace();
+            bool ok;
+            if (first != last && (*first == '-' || *first == '+')) {
+                bool negate = *first++ == '-';
+                ok = unary();
+                if (ok && negate) emit(NEG);
+            } else {
+                ok = primary();
+            }
+            --nesting;
+            return ok;
+        }
+        bool primary() {
+            if (first == last) return fail("expected a number, name or '('");
+            if (*first == '(') {
+                ++first;
+                if (!expr()) return false;
+                skipSpace();
+                if (first == last || *first != ')') return fail("expected ')'");
+                ++first;
+                return true;
+            }
+            if (std::isalpha((unsigned char)*first) || *first == '_') {
+                const char* begin = first;
+                while (first != last && (std::isalnum((unsigned char)*first) || *first == '_')) ++first;
+                std::string name(begin, first);
+                auto it = std::find(f.variables.begin(), f.variables.end(), name);
+                if (it == f.variables.end()) it = f.variables.insert(it, std::move(name));
+                push(PUSH_VAR, (std::uint32_t)(it - f.variables.begin()));
+                return true;
+            }
+            double v;
+            auto r = std::from_chars(first, last, v);
+            if (r.ec != std::errc()) return fail("expected a number, name or '('");
+            first = r.ptr;
+            f.constants.push_back(v);
+            push(PUSH_CONST, (std::uint32_t)(f.constants.size() - 1));
+            return true;
+        }
+    };
+
+public:
+    //Replaces the current program, on failure error (when given) says what and where
+    bool compile(std::string_view text, std::string* error = nullptr) {
+        program.clear(); constants.clear(); variables.clear(); depth = 0;
+        Parser parser{ *this, text.data(), text.data(), text.data() + text.size(), std::string() };
+        bool ok = parser.expr();
+        parser.skipSpace();
+        if (ok && parser.first != parser.last) ok = parser.fail("unexpected character");
+        if (ok && depth > MAX_DEPTH) ok = parser.fail("formula nests too deeply");
+        if (!ok) {
+            if (error) *error = parser.error;
+            program.clear(); constants.clear(); variables.clear(); depth = 0;
+        }
+        return ok;
+    }
+    bool empty() const { return program.empty(); }
+    //Variable names in the order evaluate() expects their values or columns
+    const std::vector<std::string>& names() const { return variables; }
+
+    //One row, values[v] is the value of names()[v]
+    double evaluate(const double* values, unsigned char* status = nullptr) const {
+        double stack[MAX_DEPTH];
+        std::size_t sp = 0;
+        unsigned char st = EVAL_OK;
+        for (const Instr& in : program) {
+            switch (in.code) {
+                case PUSH_CONST: stack[sp++] = constants[in.arg]; break;
+                case PUSH_VAR: stack[sp++] = values[in.arg]; break;
+                case NEG: stack[sp - 1] = -stack[sp - 1]; break;
+                default: {
+                    double b = stack[--sp], &a = stack[sp - 1];
+                    if (in.code == ADD) a += b;
+                    else if (in.code == SUB) a -= b;
+                    else if (in.code == MUL) a *= b;
+                    else if (b == 0) { a = std::numeric_limits<double>::quiet_NaN(); st = EVAL_DIVISION_BY_ZERO; }
+                    else a /= b;
+                }
+            }
+        }
+        if (status) *status = st;
+        return stack[0];
+    }
+
+    //n rows at once, columns[v] holds the n values of names()[v]. Each instruction
+    //runs over a block of rows through BatchEvaluator's vectorised kernels.
+    void evaluate(const double* const* columns, double* results, unsigned char* status, std::size_t n) const {
+        std::vector<double> scratch(depth * BLOCK);
+        std::vector<unsigned char> opStatus(BLOCK);
+        const double* slot[MAX_DEPTH]; //Operand stack, entries point at a column or a scratch row
+        for (std::size_t base = 0; base < n; base += BLOCK) {
+            std::size_t m = std::min(BLOCK, n - base), sp = 0;
+            unsigned char* st = status + base;
+            std::fill(st, st + m, (unsigned char)EVAL_OK);
+            for (const Instr& in : program) {
+                switch (in.code) {
+                    case PUSH_CONST: {
+                        double* dst = scratch.data() + sp * BLOCK;
+                        std::fill(dst, dst + m, constants[in.arg]);
+                        slot[sp++] = dst;
+                        break;
+                    }
+                    case PUSH_VAR: slot[sp++] = columns[in.arg] + base; break;
+                    case NEG: {
+                        double* dst = scratch.data() + (sp - 1) * BLOCK;
+                        for (std::size_t i = 0; i < m; ++i) dst[i] = -slot[sp - 1][i];
+                        slot[sp - 1] = dst;
+                        break;
+                    }
+                    default: {
+                        --sp;
+                        double* dst = scratch.data() + (sp - 1) * BLOCK;
+                        BatchEvaluator::evaluateColumn(opChar(in.code), slot[sp - 1], slot[sp], dst, opStatus.data(), m);
+                        if (in.code == DIV) for (std::size_t i = 0; i < m; ++i) st[i] |= opStatus[i];
+                        slot[sp - 1] = dst;
+                    }
+                }
+            }
+            std::copy(slot[0], slot[0] + m, results + base);
+        }
+    }
+};
+
+
+//Parses "a op b" without allocating, spaces around the parts are optional
+bool parseExpression(const char* first, const char* last, double& a, char& op, double& b) {
+    auto skipSpace = [&] { while (first != last && (*first == ' ' || *first == '\t' || *first == '\r')) ++first; };
+    auto number = [&](double& v) {
+        skipSpace();
+        if (first != last && *first == '+') ++first; //from_chars does not accept a leading plus
+        auto r = std::from_chars(first, last, v);
+        if (r.ec != std::errc()) return false;
+        first = r.ptr;
+        return true;
+    };
+    if (!number(a)) return false;
+    skipSpace();
+    if (first == last) return false;
+    op = *first++;
+    return number(b);
+}
+
+//Appends one results.txt line
+void appendResult(std::string& out, double a, char op, double b, double result, unsigned char status) {
+    if (status != EVAL_OK) {
+        out += "Error evaluating expression: ";
+        out += evalStatusMessage(status);
+        out += '\n';
+        return;
+    }
+    appendNumber(out, a); out += ' '; out += op; out += ' '; appendNumber(out, b);
+    out += " -> "; appendNumber(out, result); out += '\n';
+}
+
+//Output of one chunk of input lines
+struct ChunkResult {
+    std::string text;
+    std::size_t rows = 0, errors = 0;
+};
+
+//Parses and evaluates a chunk of complete lines. Lines that are not "a op b"
+//produce an error line so the output keeps one line per input expression.
+ChunkResult processChunk(const std::string& chunk) {
+    const std::uint32_t UNPARSED = 0xFFFFFFFFu;
+    std::vector<double> lhs, rhs;
+    std::vector<char> ops;
+    std::vector<std::uint32_t> rowOfLine;
+    for (std::size_t pos = 0; pos < chunk.size(); ) {
+        std::size_t end = chunk.find('\n', pos);
+        if (end == std::string::npos) end = chunk.size();
+        const char* first = chunk.data() + pos;
+        const char* last = chunk.data() + end;
+        pos = end + 1;
+        while (first != last && (*first == ' ' || *first == '\t' || *first == '\r')) ++first;
+        if (first == last) continue; //Blank line
+        double a, b;
+        char op;
+        if (!parseExpression(first, last, a, op, b)) { rowOfLine.push_back(UNPARSED); continue; }
+        rowOfLine.push_back((std::uint32_t)lhs.size());
+        lhs.push_back(a); ops.push_back(op); rhs.push_back(b);
+    }
+    std::vector<double> results(lhs.size());
+    std::vector<unsigned char> status(lhs.size());
+    BatchEvaluator::evaluate(lhs.data(), ops.data(), rhs.data(), results.data(), status.data(), lhs.size());
+
+    ChunkResult out;
+    out.text.reserve(rowOfLine.size() * 32);
+    for (std::uint32_t row : rowOfLine) {
+        ++out.rows;
+        if (row == UNPARSED) { out.text += "Error evaluating expression: Invalid input\n"; ++out.errors; continue; }
+        if (status[row] != EVAL_OK) ++out.errors;
+        appendResult(out.text, lhs[row], ops[row], rhs[row], results[row], status[row]);
+    }
+    METRIC_COUNT("records_parsed", lhs.size());
+    METRIC_COUNT("parse_errors", rowOfLine.size() - lhs.size());
+    METRIC_COUNT("evaluation_errors", out.errors - (rowOfLine.size() - lhs.size()));
+    return out;
+}
+
+struct PipelineStats {
+    std::size_t rows = 0, errors = 0;
+};
+
+//Streams lines from in to out: the calling thread reads newline-aligned chunks,
+//the pool turns each into a ChunkResult with process(chunk) and results are
+//written back in input order. At most two chunks per thread are in memory at any time.
+template <class Process> PipelineStats runPipeline(std::istream& in, std::ostream& out, unsigned threads, Process process) {
+    const std::size_t CHUNK = 1 << 20;
+    WorkerPool pool(threads);
+    const std::size_t maxInFlight = 2 * pool.size();
+    std::deque<std::future<ChunkResult>> inFlight;
+    PipelineStats stats;
+    auto writeOldest = [&] {
+        ChunkResult r = inFlight.front().get();
+        inFlight.pop_front();
+        out.write(r.text.data(), r.text.size());
+        stats.rows += r.rows;
+        stats.errors += r.errors;
+    };
+
+    std::string carry; //Partial line left over from the previous read
+    while (in) {
+        std::string chunk = std::move(carry);
+        carry.clear();
+        std::size_t old = chunk.size();
+        chunk.resize(old + CHUNK);
+        in.read(&chunk[old], CHUNK);
+        chunk.resize(old + (std::size_t)in.gcount());
+        METRIC_COUNT("bytes_read", in.gcount());
+        if (in) { //More input follows, only hand over complete lines
+            std::size_t nl = chunk.rfind('\n');
+            if (nl == std::string::npos) { carry = std::move(chunk); continue; } //Line longer than a chunk
+            carry.assign(chunk, nl + 1, std::string::npos);
+            chunk.resize(nl + 1);
+        }
+        if (chunk.empty()) continue;
+        if (inFlight.size() >= maxInFlight) writeOldest();
+        inFlight.push_back(pool.submit([c = std::move(chunk), &process] { return process(c); }));
+    }
+    while (!inFlight.empty()) writeOldest();
+    out.flush();
+    return stats;
+}
+
+//"a op b" expressions, one per line
+PipelineStats runPipeline(std::istream& in, std::ostream& out, unsigned threads = 0) {
+    return runPipeline(in, out, threads, processChunk);
+}
+
+//Splits a line of numbers separated by commas and/or spaces, false if any field is not a number
+bool parseFields(const char* first, const char* last, std::vector<double>& fields) {
+    fields.clear();
+    while (true) {
+        while (first != last && (*first == ' ' || *first == '\t' || *first == '\r' || *first == ',')) ++first;
+        if (first == last) return true;
+        if (*first == '+') ++first;
+        double v;
+        auto r = std::from_chars(first, last, v);
+        if (r.ec != std::errc()) return false;
+        fields.push_back(v);
+        first = r.ptr;
+    }
+}
+
+//Evaluates formula for every row of a chunk of numeric lines. fieldOf[v] is the
+//input column bound to the formula's v-th variable, rows need fieldCount fields.
+ChunkResult processFormulaChunk(const Formula& formula, const std::vector<std::size_t>& fieldOf, std::size_t fieldCount,
+                                const std::string& chunk) {
+    const std::uint32_t UNPARSED = 0xFFFFFFFFu;
+    std::vector<std::vector<double>> columns(fieldOf.size());
+    std::vector<std::uint32_t> rowOfLine;
+    std::vector<double> fields;
+    std::uint32_t rows = 0;
+    for (std::size_t pos = 0; pos < chunk.size(); ) {
+        std::size_t end = chunk.find('\n', pos);
+        if (end == std::string::npos) end = chunk.size();
+        const char* first = chunk.data() + pos;
+        const char* last = chunk.data() + end;
+        pos = end + 1;
+        if (!parseFields(first, last, fields)) { rowOfLine.push_back(UNPARSED); continue; }
+        if (fields.empty()) continue; //Blank line
+        if (fields.size() != fieldCount) { rowOfLine.push_back(UNPARSED); continue; }
+        for (std::size_t v = 0; v < fieldOf.size(); ++v) columns[v].push_back(fields[fieldOf[v]]);
+        rowOfLine.push_back(rows++);
+    }
+    std::vector<const double*> bindings(columns.size());
+    for (std::size_t v = 0; v < columns.size(); ++v) bindings[v] = columns[v].data();
+    std::vector<double> results(rows);
+    std::vector<unsigned char> status(rows);
+    formula.evaluate(bindings.data(), results.data(), status.data(), rows);
+
+    ChunkResult out;
+    out.text.reserve(rowOfLine.size() * 12);
+    for (std::uint32_t row : rowOfLine) {
+        ++out.rows;
+        if (row == UNPARSED) { out.text += "Error evaluating expression: Invalid input\n"; ++out.errors; continue; }
+        if (status[row] != EVAL_OK) {
+            out.text += "Error evaluating expression: ";
+            out.text += evalStatusMessage(status[row]);
+            out.text += '\n';
+            ++out.errors;
+            continue;
+        }
+        appendNumber(out.text, results[row]);
+        out.text += '\n';
+    }
+    return out;
+}
+
+//Applies one formula to a table whose first line names the columns, e.g. "price,tax,discount".
+//Every variable of the formula has to be one of the columns.
+bool runFormula(const std::string& text, std::istream& in, std::ostream& out, unsigned threads, PipelineStats& stats, std::string& error) {
+    Formula formula;
+    if (!formula.compile(text, &error)) return false;
+    std::string header;
+    if (!std::getline(in, header)) { error = "missing header line"; return false; }
+    std::vector<std::string> columns;
+    for (std::size_t pos = 0; pos <= header.size(); ) {
+        std::size_t end = header.find_first_of(", \t\r", pos);
+        if (end == std::string::npos) end = header.size();
+        if (end > pos) columns.push_back(header.substr(pos, end - pos));
+        pos = end + 1;
+    }
+    std::vector<std::size_t> fieldOf;
+    for (const std::string& name : formula.names()) {
+        auto it = std::find(columns.begin(), columns.end(), name);
+        if (it == columns.end()) { error = "no column named '" + name + "'"; return false; }
+        fieldOf.push_back((std::size_t)(it - columns.begin()));
+    }
+    std::size_t fieldCount = columns.size();
+    stats = runPipeline(in, out, threads, [&](const std::string& chunk) {
+        return processFormulaChunk(formula, fieldOf, fieldCount, chunk);
+    });
+    return true;
+}
+
+
+#ifndef BINOP2_NO_MAIN
 // Running the code
-int main() {
+int main(int argc, char* argv[]) {
+    METRICS_DUMP_AT_EXIT();
+
+    //Formula mode: binOp2 --formula "<expression>" <input file or -> [output file] [threads]
+    if (argc >= 4 && std::string(argv[1]) == "--formula") {
+        std::string outName = argc >= 5 ? argv[4] : "results.txt";
+        unsigned threads = argc >= 6 ? (unsigned)std::atoi(argv[5]) : 0;
+        std::ifstream fin;
+        std::istream* in = &std::cin;
+        if (std::string(argv[3]) != "-") {
+            fin.open(argv[3], std::ios::binary);
+            if (!fin) { std::cerr << "Cannot open " << argv[3] << "\n"; return 1; }
+            in = &fin;
+        }
+        std::ofstream fout(outName, std::ios::binary);
+        PipelineStats stats;
+        std::string error;
+        if (!runFormula(argv[2], *in, fout, threads, stats, error)) { std::cerr << "Formula error: " << error << "\n"; return 1; }
+        std::cout << stats.rows << " row(s), " << stats.errors << " error(s). Results written to " << outName << "\n";
+        return 0;
+    }
 
-    const int MAX_EXPRESSIONS = 5;
-    BinOp expressions[MAX_EXPRESSIONS];
+    //Streaming mode for large inputs: binOp2 <input file or -> [output file] [threads]
+    if (argc >= 2) {
+        std::string outName = argc >= 3 ? argv[2] : "results.txt";
+        unsigned threads = argc >= 4 ? (unsigned)std::atoi(argv[3]) : 0;
+        std::ifstream fin;
+        std::istream* in = &std::cin;
+        if (std::string(argv[1]) != "-") {
+            fin.open(argv[1], std::ios::binary);
+            if (!fin) { std::cerr << "Cannot open " << argv[1] << "\n"; return 1; }
+            in = &fin;
+        }
+        std::ofstream fout(outName, std::ios::binary);
+        PipelineStats stats = runPipeline(*in, fout, threads);
+        std::cout << stats.rows << " expression(s), " << stats.errors << " error(s). Results written to " << outName << "\n";
+        return 0;
+    }
+
+    std::vector<BinOp> expressions;
+    std::vector<double> results;
+    ResultCache cache(4096); //Validation computes each result once, repeats are looked up
     int count = 0;
 
     std::string line;
-    std::cout << "Enter up to " << MAX_EXPRESSIONS << " expressions. Enter 'q' to quit.\n";
-
-    while (count < MAX_EXPRESSIONS) {
-        std::cout << "Expression " << (count + 1) << ": ";
-        std::getline(std::cin, line);
+    std::cout << "Enter expressions. Enter 'q' to quit.\n";
 
+    while (std::cout << "Expression " << (count + 1) << ": " && std::getline(std::cin, line)) {
         if (line == "q" || line == "Q") break; //Quit
-        std::istringstream iss(line);
         double a, b;
         char op;
-        if (!(iss >> a >> op >> b)) { //Structure has to be  a op b
+        if (!parseExpression(line.data(), line.data() + line.size(), a, op, b)) { //Structure has to be  a op b
             std::cout << "Invalid input. Try again.\n";
             continue;
         }
-        try { //Validation
-            BinOp temp(a, op, b);
-            temp.evaluate(); //Test for errors
-            expressions[count++] = temp;
-        } catch (const std::exception& e) {
-            std::cout << "Error: " << e.what() << "\n";
+        BinOp temp(a, op, b);
+        double result;
+        unsigned char status = temp.evaluate(cache, result); //Validation, the result is kept for the file
+        if (status != EVAL_OK) {
+            std::cout << "Error: " << evalStatusMessage(status) << "\n";
+            continue;
         }
+        expressions.push_back(temp);
+        results.push_back(result);
+        ++count;
     }
 
-    //Outputting results to file
+    //Outputting results to file in large blocks
     std::ofstream fout("results.txt");
-    for (int i = 0; i < count; ++i) {
-        try {
-            double result = expressions[i].evaluate();
-
-            //Writing to file
-            fout << expressions[i].getOperand1() << " "
-                 << expressions[i].getOperator() << " "
-                 << expressions[i].getOperand2() << " -> "
-                 << result << std::endl;
-
-        } catch (const std::exception& e) {
-            fout << "Error evaluating expression: " << e.what() << std::endl;
+    {
+        OutputBuffer out(fout);
+        for (int i = 0; i < count; ++i) {
+            const BinOp& e = expressions[i];
+            appendResult(out.text(), e.getOperand1(), e.getOperator(), e.getOperand2(), results[i], EVAL_OK);
+            out.commit();
         }
     }
     fout.close();
     std::cout << "Results written to results.txt\n";
     return 0;
     
-}
\ No newline at end of file
+}
+#endif
@@ -0,0 +1,46 @@
+#ifndef ITEM_ARENA_H
+#define ITEM_ARENA_H
+
+#include <cstddef>
+#include <list>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <utility>
+#include "metrics.h"
+
+//Allocator item classes take for their string fields
+typedef std::pmr::polymorphic_allocator<char> StringAllocator;
+
+//Monotonic arena for item objects and their strings. Objects placed here are
+//never destroyed one by one, all their memory goes back in a single release
+//when the arena is destroyed. Only put types here whose memory comes entirely
+//from the arena (strings built with allocator()).
+class ItemArena {
+    std::pmr::monotonic_buffer_resource resource;
+    std::list<ItemArena> shards;
+    std::mutex shardLock;
+public:
+    explicit ItemArena(std::size_t initialBytes = 64 * 1024) : resource(initialBytes) {}
+    ItemArena(const ItemArena&) = delete;
+    ItemArena& operator=(const ItemArena&) = delete;
+
+    std::pmr::memory_resource* memory() { return &resource; }
+    StringAllocator allocator() { return StringAllocator(&resource); }
+
+    //Constructs T(args..., allocator()) inside the arena
+    template <class T, class... Args> T* make(Args&&... args) {
+        METRIC_COUNT("arena_allocations", 1);
+        void* p = resource.allocate(sizeof(T), alignof(T));
+        return ::new (p) T(std::forward<Args>(args)..., allocator());
+    }
+
+    //An ItemArena is not thread-safe. Parallel loaders take one shard per thread,
+    //the shard's memory stays alive until this arena is destroyed.
+    ItemArena& shard() {
+        std::lock_guard<std::mutex> lock(shardLock);
+        return shards.emplace_back();
+    }
+};
+
+#endif
@@ -0,0 +1,306 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+
+//CRC-32 (IEEE 802.3), used to detect torn or corrupted journal records
+inline std::uint32_t crc32(const char* data, std::size_t n, std::uint32_t crc = 0) {
+    static const struct Table {
+        std::uint32_t v[256];
+        Table() {
+            for (std::uint32_t i = 0; i < 256; ++i) {
+                std::uint32_t c = i;
+                for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                v[i] = c;
+            }
+        }
+    } table;
+    crc = ~crc;
+    for (std::size_t i = 0; i < n; ++i) crc = table.v[(crc ^ (std::uint8_t)data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+struct JournalOptions {
+    std::size_t syncEvery = 32;                      //Group commit: fsync once this many records are pending
+    std::chrono::milliseconds syncInterval{ 100 };   //...or once this much time has passed
+    std::uint64_t compactBytes = 8 << 20;            //Log size at which wantsCompaction() turns true
+    std::chrono::milliseconds compactInterval{ 60000 }; //...or time since the last compaction with records logged, 0 for never
+};
+
+//Append-only write-ahead log. Every record is stored as
+//  u32 payload length | u32 CRC-32 of sequence and payload | u64 sequence | payload
+//in little-endian order. Appends are buffered and a background thread writes and
+//fsyncs them in groups. Compaction writes a snapshot covering every record up to
+//a sequence number and then drops those records from the log. The snapshot file
+//has to remember that sequence number so recovery knows where to resume. With a
+//compaction handler set, the background thread also starts compactions when due.
+//The first failed write, fsync or compaction marks the log failed (see failed()):
+//nothing more is written to it and append(), sync() and close() report it, until
+//a compaction covering every record appended so far succeeds.
+class Journal {
+    static constexpr std::size_t HEADER = 16;
+    std::string path;
+    JournalOptions opt;
+    int fd = -1;
+    std::mutex m;              //Guards pending, counters and stopping
+    std::mutex io;             //Serialises writes to fd with compaction rewriting the file
+    std::condition_variable cv;
+    std::string pending;       //Encoded records not yet written
+    std::size_t unsynced = 0;
+    std::uint64_t nextSeq = 1;
+    std::uint64_t fileBytes = 0;
+    std::chrono::steady_clock::time_point lastCompaction;
+    std::function<void()> compactionHandler;
+    bool stopping = false;
+    std::atomic<bool> compacting{ false };
+    std::atomic<bool> failure{ false };
+    std::uint64_t failedAt = 0; //Last sequence appended when the log failed
+    std::mutex compactors;     //Serialises compact() callers, the menu and the background thread
+    std::thread syncer, compactor;
+
+    static void put(std::string& out, std::uint64_t v, int bytes) {
+        for (int b = 0; b < bytes; ++b) out.push_back((char)(v >> (8 * b)));
+    }
+    static std::uint64_t get(const char* p, int bytes) {
+        std::uint64_t v = 0;
+        for (int b = 0; b < bytes; ++b) v |= (std::uint64_t)(std::uint8_t)p[b] << (8 * b);
+        return v;
+    }
+    static bool writeAll(int f, const char* p, std::size_t n) {
+        while (n > 0) {
+            ssize_t w = ::write(f, p, n);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) return false;
+            p += w; n -= (std::size_t)w;
+        }
+        return true;
+    }
+    static bool syncDirectory(const std::string& file) { //Makes a new or renamed directory entry of file durable
+        std::size_t slash = file.rfind('/');
+        std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : file.substr(0, slash);
+        int d = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+        if (d < 0) return false;
+        bool ok = ::fsync(d) == 0;
+        ::close(d);
+        return ok;
+    }
+    static bool writeFile(const std::string& file, std::string_view data) { //Durable replace via temp file and rename
+        std::string tmp = file + ".tmp";
+        int f = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (f < 0) return false;
+        bool ok = writeAll(f, data.data(), data.size()) && ::fsync(f) == 0;
+        ::close(f);
+        return ok && std::rename(tmp.c_str(), file.c_str()) == 0 && syncDirectory(file);
+    }
+    //Reads the whole log, calls f(seq, payload) for each intact record and returns the
+    //length of the intact prefix
+    template <class F> static std::uint64_t scan(const std::string& data, F f) {
+        std::uint64_t pos = 0;
+        while (data.size() - pos >= HEADER) {
+            const char* p = data.data() + pos;
+            std::uint64_t len = get(p, 4);
+            if (data.size() - pos - HEADER < len) break; //Torn write at the tail
+            if (get(p + 4, 4) != crc32(p + 8, 8 + len)) break;
+            f(get(p + 8, 8), std::string_view(p + HEADER, len));
+            pos += HEADER + len;
+        }
+        return pos;
+    }
+    static std::string readAll(const std::string& file) {
+        std::ifstream ifs(file, std::ios::binary | std::ios::ate);
+        if (!ifs) return std::string();
+        std::string data((std::size_t)ifs.tellg(), '\0');
+        ifs.seekg(0);
+        ifs.read(&data[0], data.size());
+        return data;
+    }
+
+    bool flushPending(bool fsyncToo) { //Called with io held, false once the log has failed
+        std::string batch;
+        {
+            std::lock_guard<std::mutex> lock(m);
+            batch.swap(pending);
+            unsynced = 0;
+        }
+        if (failure) return false; //Records after a torn one would not be replayed anyway
+        if (batch.empty()) return true;
+        if (!writeAll(fd, batch.data(), batch.size()) || (fsyncToo && ::fdatasync(fd) != 0)) {
+            fail();
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(m);
+        fileBytes += batch.size();
+        return true;
+    }
+    void fail() {
+        std::lock_guard<std::mutex> lock(m);
+        if (!failure) failedAt = nextSeq - 1;
+        failure = true;
+    }
+    bool compactionDue() const { //Called with m held
+        std::uint64_t logged = fileBytes + pending.size();
+        if (logged >= opt.compactBytes) return true;
+        return logged > 0 && opt.compactInterval.count() > 0 && std::chrono::steady_clock::now() - lastCompaction >= opt.compactInterval;
+    }
+    void syncLoop() {
+        std::unique_lock<std::mutex> lock(m);
+        while (!stopping) {
+            cv.wait_for(lock, opt.syncInterval, [&] { return stopping || unsynced >= opt.syncEvery; });
+            if (!pending.empty()) {
+                lock.unlock();
+                {
+                    std::lock_guard<std::mutex> ioLock(io);
+                    flushPending(true);
+                }
+                lock.lock();
+            }
+            if (compactionHandler && !stopping && !compacting && compactionDue()) {
+                std::function<void()> f = compactionHandler;
+                lock.unlock();
+                f();
+                lock.lock();
+            }
+        }
+    }
+
+public:
+    Journal() = default;
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+    ~Journal() { close(); }
+
+    //Replays the records after afterSeq through f(seq, payload), cuts off a torn or
+    //corrupt tail left by a crash and opens the log for appending
+    template <class F> bool open(const std::string& file, std::uint64_t afterSeq, F f, JournalOptions options = JournalOptions()) {
+        close();
+        failure = false;
+        path = file;
+        opt = options;
+        std::string data = readAll(path);
+        std::uint64_t last = afterSeq;
+        std::uint64_t good = scan(data, [&](std::uint64_t seq, std::string_view payload) {
+            if (seq > afterSeq) f(seq, payload);
+            if (seq > last) last = seq;
+        });
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+        if (fd < 0) return false;
+        if (data.empty()) syncDirectory(path); //The log may be new
+        if (good != data.size() && ::ftruncate(fd, (off_t)good) != 0) {
+            ::close(fd);
+            fd = -1;
+            return false;
+        }
+        ::lseek(fd, 0, SEEK_END);
+        nextSeq = last + 1;
+        fileBytes = good;
+        lastCompaction = std::chrono::steady_clock::now();
+        stopping = false;
+        syncer = std::thread([this] { syncLoop(); });
+        return true;
+    }
+    bool isOpen() const { return syncer.joinable(); } //fd itself changes under a compaction
+
+    //Returns the record's sequence number, 0 once the log has failed. The record is
+    //written later, a failure then shows in failed(), sync() and close().
+    std::uint64_t append(std::string_view payload) {
+        std::lock_guard<std::mutex> lock(m);
+        if (failure) return 0;
+        std::uint64_t seq = nextSeq++;
+        std::size_t start = pending.size();
+        put(pending, payload.size(), 4);
+        put(pending, 0, 4); //CRC, filled in below
+        put(pending, seq, 8);
+        pending.append(payload.data(), payload.size());
+        std::uint32_t crc = crc32(pending.data() + start + 8, 8 + payload.size());
+        for (int b = 0; b < 4; ++b) pending[start + 4 + b] = (char)(crc >> (8 * b));
+        if (++unsynced >= opt.syncEvery) cv.notify_one();
+        return seq;
+    }
+    std::uint64_t lastSeq() {
+        std::lock_guard<std::mutex> lock(m);
+        return nextSeq - 1;
+    }
+    bool sync() { //Makes everything appended so far durable, false if the log has failed
+        std::lock_guard<std::mutex> ioLock(io);
+        return flushPending(true);
+    }
+    bool failed() const { return failure; }
+    bool wantsCompaction() { //False while a compaction is already running
+        if (compacting) return false;
+        std::lock_guard<std::mutex> lock(m);
+        return compactionDue();
+    }
+    //Has the background thread call f whenever wantsCompaction() turns true, f is
+    //expected to call compact(). Threads changing what f snapshots must lock against
+    //it, and close() waits for a running f, so it must not hold a lock f takes.
+    void setCompactionHandler(std::function<void()> f) {
+        std::lock_guard<std::mutex> lock(m);
+        compactionHandler = std::move(f);
+    }
+
+    //Writes snapshot, which must cover every record up to seq, to snapshotFile on a
+    //background thread and then drops those records from the log. Waits for a
+    //previous compaction to finish first. A failure leaves the log as it was and
+    //marks it failed.
+    void compact(std::uint64_t seq, std::string snapshot, const std::string& snapshotFile) {
+        std::lock_guard<std::mutex> guard(compactors);
+        if (compactor.joinable()) compactor.join();
+        compacting = true;
+        {
+            std::lock_guard<std::mutex> lock(m);
+            lastCompaction = std::chrono::steady_clock::now(); //A failed one is retried an interval later
+        }
+        compactor = std::thread([this, seq, snapshot = std::move(snapshot), snapshotFile] {
+            struct Done { std::atomic<bool>& flag; ~Done() { flag = false; } } done{ compacting };
+            if (!writeFile(snapshotFile, snapshot)) { fail(); return; } //Keep the full log
+            std::lock_guard<std::mutex> ioLock(io);
+            flushPending(false);
+            std::string data = readAll(path), kept;
+            scan(data, [&](std::uint64_t s, std::string_view payload) {
+                if (s > seq) kept.append(payload.data() - HEADER, HEADER + payload.size()); //Whole record as is
+            });
+            int nfd = writeFile(path, kept) ? ::open(path.c_str(), O_WRONLY | O_APPEND) : -1;
+            if (nfd < 0) { fail(); return; }
+            ::close(fd);
+            fd = nfd;
+            std::lock_guard<std::mutex> lock(m);
+            fileBytes = kept.size();
+            if (failure && seq >= failedAt) failure = false; //The snapshot holds whatever the log lost
+        });
+    }
+    void waitForCompaction() {
+        std::lock_guard<std::mutex> guard(compactors);
+        if (compactor.joinable()) compactor.join();
+    }
+
+    bool close() { //Flushes, fsyncs and stops the background threads, false if the log has failed
+        if (!isOpen()) return !failure;
+        {
+            std::lock_guard<std::mutex> lock(m);
+            stopping = true;
+        }
+        cv.notify_all();
+        syncer.join(); //First, it may start compactions
+        waitForCompaction();
+        bool ok = sync();
+        if (::close(fd) != 0) fail();
+        fd = -1;
+        return ok && !failure;
+    }
+};
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef LZ_CODEC_H
+#define LZ_CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+//LZ77 byte codec in the spirit of LZ4's block format, for the compressed items.bin
+//blocks. Compressed data is a run of sequences: a token byte (literal count in the
+//high nibble, match length minus 4 in the low one, 15 meaning extra length bytes
+//follow, each adding up to 255), the literals, then a little-endian u16 distance
+//back into the output where the match is copied from. The last sequence has
+//literals only. No entropy coding, so decoding is a loop of copies.
+
+constexpr std::size_t LZ_MIN_MATCH = 4;
+
+//Largest possible output of lzCompress() for n input bytes
+inline std::size_t lzCompressBound(std::size_t n) { return n + n / 255 + 16; }
+
+//Compresses n bytes (under 4 GiB) of src into dst, which must have room for
+//lzCompressBound(n) bytes. Returns the number of bytes written.
+inline std::size_t lzCompress(const char* src, std::size_t n, char* dst) {
+    constexpr int HASH_BITS = 14;
+    constexpr std::size_t MAX_DISTANCE = 65535, LAST_LITERALS = 5; //The tail is always left as literals
+    const unsigned char* in = (const unsigned char*)src;
+    unsigned char* out = (unsigned char*)dst;
+    std::uint32_t table[1 << HASH_BITS] = {}; //Last position seen for each hash of 4 bytes
+    auto load32 = [&](std::size_t i) { std::uint32_t v; std::memcpy(&v, in + i, 4); return v; };
+    auto writeLength = [&](std::size_t len) {
+        for (; len >= 255; len -= 255) *out++ = 255;
+        *out++ = (unsigned char)len;
+    };
+    auto writeLiterals = [&](unsigned char* token, std::size_t from, std::size_t count) {
+        *token = (unsigned char)((count < 15 ? count : 15) << 4);
+        if (count >= 15) writeLength(count - 15);
+        std::memcpy(out, in + from, count);
+        out += count;
+    };
+
+    std::size_t anchor = 0, i = 0;
+    std::size_t matchEnd = n > LAST_LITERALS ? n - LAST_LITERALS : 0;
+    while (i + LZ_MIN_MATCH <= matchEnd) {
+        std::uint32_t seq = load32(i);
+        std::uint32_t h = (seq * 2654435761u) >> (32 - HASH_BITS);
+        std::size_t cand = table[h];
+        table[h] = (std::uint32_t)i;
+        if (cand >= i || i - cand > MAX_DISTANCE || load32(cand) != seq) {
+            i += 1 + ((i - anchor) >> 6); //Steps up over incompressible runs
+            continue;
+        }
+        std::size_t len = LZ_MIN_MATCH;
+        while (i + len < matchEnd && in[cand + len] == in[i + len]) ++len;
+        unsigned char* token = out++;
+        writeLiterals(token, anchor, i - anchor);
+        std::size_t distance = i - cand, extra = len - LZ_MIN_MATCH;
+        *out++ = (unsigned char)distance;
+        *out++ = (unsigned char)(distance >> 8);
+        *token |= (unsigned char)(extra < 15 ? extra : 15);
+        if (extra >= 15) writeLength(extra - 15);
+        i += len;
+        anchor = i;
+    }
+    writeLiterals(out++, anchor, n - anchor);
+    return (std::size_t)(out - (unsigned char*)dst);
+}
+
+//Decompresses n bytes of src into dst, which must be exactly rawSize bytes long.
+//Returns false for malformed input, never reading or writing out of bounds.
+inline bool lzDecompress(const char* src, std::size_t n, char* dst, std::size_t rawSize) {
+    const unsigned char* ip = (const unsigned char*)src;
+    const unsigned char* iend = ip + n;
+    unsigned char* op = (unsigned char*)dst;
+    unsigned char* const obegin = op;
+    unsigned char* const oend = op + rawSize;
+    auto readLength = [&](std::size_t& len) {
+        unsigned char b;
+        do {
+            if (ip == iend) return false;
+            b = *ip++;
+            len += b;
+        } while (b == 255);
+        return true;
+    };
+    while (ip != iend) {
+        unsigned token = *ip++;
+        std::size_t literals = token >> 4;
+        if (literals == 15 && !readLength(literals)) return false;
+        if ((std::size_t)(iend - ip) < literals || (std::size_t)(oend - op) < literals) return false;
+        if (literals <= 16 && iend - ip >= 16 && oend - op >= 16) std::memcpy(op, ip, 16); //Fixed size, the spare bytes are overwritten later
+        else std::memcpy(op, ip, literals);
+        ip += literals;
+        op += literals;
+        if (ip == iend) return op == oend; //Literals-only final sequence
+        if (iend - ip < 2) return false;
+        std::size_t distance = ip[0] | (std::size_t)ip[1] << 8;
+        ip += 2;
+        std::size_t len = token & 15;
+        if (len == 15 && !readLength(len)) return false;
+        len += LZ_MIN_MATCH;
+        if (distance == 0 || distance > (std::size_t)(op - obegin) || (std::size_t)(oend - op) < len) return false;
+        const unsigned char* match = op - distance;
+        if (distance >= 8 && (std::size_t)(oend - op) >= len + 8) {
+            for (std::size_t k = 0; k < len; k += 8) std::memcpy(op + k, match + k, 8); //Each chunk only reads bytes already written
+        } else if (distance >= len) {
+            std::memcpy(op, match, len);
+        } else for (std::size_t k = 0; k < len; ++k) op[k] = match[k]; //Overlapping copy repeats the last distance bytes
+        op += len;
+    }
+    return false;
+}
+
+#endif
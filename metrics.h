@@ -0,0 +1,162 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+//Counters and latency histograms for the hot paths, used only through the macros
+//at the bottom:
+//  METRIC_COUNT("records_parsed", n);  adds n to a counter
+//  METRIC_TIMER("load_binary");        times the rest of the enclosing scope
+//  METRICS_DUMP_AT_EXIT();             writes everything out when the program exits
+//Unless OOP_LABS_METRICS is defined the macros expand to nothing, arguments are
+//not even evaluated. When it is, every thread records into its own slots and a
+//dump sums them, so recording never takes a lock or a contended cache line.
+
+#ifdef OOP_LABS_METRICS
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace metrics {
+
+constexpr unsigned MAX_COUNTERS = 64;
+constexpr unsigned MAX_TIMERS = 32;
+constexpr unsigned BUCKETS = 40; //Bucket b holds durations below 2^b ns, the last one everything longer
+
+//One thread's slots. Only the owning thread writes them, so an update is a plain
+//load and store, the atomics only make the concurrent reads of a dump well defined.
+struct Shard {
+    struct Timer {
+        std::atomic<std::uint64_t> buckets[BUCKETS];
+        std::atomic<std::uint64_t> count, sumNs;
+    };
+    std::atomic<std::uint64_t> counters[MAX_COUNTERS];
+    Timer timers[MAX_TIMERS];
+};
+
+inline void bump(std::atomic<std::uint64_t>& slot, std::uint64_t n) {
+    slot.store(slot.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+class Registry {
+    std::mutex m;
+    std::vector<std::string> counterNames, timerNames;
+    std::vector<std::shared_ptr<Shard>> shards; //Kept after their thread exits, its counts still matter
+
+    static unsigned find(std::vector<std::string>& names, const char* name, unsigned max) {
+        for (unsigned i = 0; i < names.size(); ++i) if (names[i] == name) return i;
+        if (names.size() + 1 == max) names.push_back("metrics_overflow"); //Shared by every name past the limit
+        if (names.size() == max) return max - 1;
+        names.push_back(name);
+        return (unsigned)names.size() - 1;
+    }
+    std::shared_ptr<Shard> attach() {
+        auto s = std::make_shared<Shard>(); //Value-initialised, so every slot starts at zero
+        std::lock_guard<std::mutex> lock(m);
+        shards.push_back(s);
+        return s;
+    }
+
+public:
+    static Registry& global() {
+        static Registry r;
+        return r;
+    }
+    //Ids for a name, the same name always gets the same id
+    unsigned counter(const char* name) { std::lock_guard<std::mutex> lock(m); return find(counterNames, name, MAX_COUNTERS); }
+    unsigned timer(const char* name) { std::lock_guard<std::mutex> lock(m); return find(timerNames, name, MAX_TIMERS); }
+    Shard& local() {
+        thread_local std::shared_ptr<Shard> s = attach();
+        return *s;
+    }
+
+    //Prometheus text exposition format, counters as <name>_total and timers as
+    //<name>_seconds histograms
+    void writePrometheus(std::ostream& os) {
+        std::lock_guard<std::mutex> lock(m);
+        auto sum = [&](auto slot) {
+            std::uint64_t v = 0;
+            for (auto& s : shards) v += slot(*s).load(std::memory_order_relaxed);
+            return v;
+        };
+        for (unsigned c = 0; c < counterNames.size(); ++c) {
+            const std::string& n = counterNames[c];
+            os << "# TYPE oop_labs_" << n << "_total counter\n";
+            os << "oop_labs_" << n << "_total " << sum([&](Shard& s) -> auto& { return s.counters[c]; }) << "\n";
+        }
+        for (unsigned t = 0; t < timerNames.size(); ++t) {
+            std::string n = "oop_labs_" + timerNames[t] + "_seconds";
+            os << "# TYPE " << n << " histogram\n";
+            std::uint64_t cumulative = 0;
+            for (unsigned b = 0; b < BUCKETS; ++b) {
+                cumulative += sum([&](Shard& s) -> auto& { return s.timers[t].buckets[b]; });
+                if (b + 1 < BUCKETS) os << n << "_bucket{le=\"" << (double)(1ull << b) / 1e9 << "\"} " << cumulative << "\n";
+            }
+            os << n << "_bucket{le=\"+Inf\"} " << cumulative << "\n";
+            os << n << "_sum " << sum([&](Shard& s) -> auto& { return s.timers[t].sumNs; }) / 1e9 << "\n";
+            os << n << "_count " << sum([&](Shard& s) -> auto& { return s.timers[t].count; }) << "\n";
+        }
+    }
+    bool dump(const std::string& file) {
+        std::ofstream ofs(file);
+        writePrometheus(ofs);
+        return (bool)ofs;
+    }
+};
+
+inline void add(unsigned counter, std::uint64_t n) { bump(Registry::global().local().counters[counter], n); }
+inline void record(unsigned timer, std::uint64_t ns) {
+    Shard::Timer& t = Registry::global().local().timers[timer];
+    unsigned width = ns ? 64 - (unsigned)__builtin_clzll(ns) : 0; //ns is below 2^width
+    bump(t.buckets[width < BUCKETS ? width : BUCKETS - 1], 1);
+    bump(t.count, 1);
+    bump(t.sumNs, ns);
+}
+
+class ScopedTimer {
+    unsigned id;
+    std::chrono::steady_clock::time_point start;
+public:
+    explicit ScopedTimer(unsigned timer) : id(timer), start(std::chrono::steady_clock::now()) {}
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+    ~ScopedTimer() {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        record(id, (std::uint64_t)ns);
+    }
+};
+
+//Dumps to $OOP_LABS_METRICS_FILE, or metrics.prom, when main returns or exit() is called
+inline void dumpAtExit() {
+    Registry::global(); //Constructed before the handler is registered, so it is still alive when it runs
+    std::atexit([] {
+        const char* file = std::getenv("OOP_LABS_METRICS_FILE");
+        Registry::global().dump(file && *file ? file : "metrics.prom");
+    });
+}
+
+}
+
+#define METRICS_CONCAT2(a, b) a##b
+#define METRICS_CONCAT(a, b) METRICS_CONCAT2(a, b)
+#define METRIC_COUNT(name, n) \
+    do { static const unsigned metricId = metrics::Registry::global().counter(name); metrics::add(metricId, (n)); } while (0)
+#define METRIC_TIMER(name) \
+    static const unsigned METRICS_CONCAT(metricTimerId, __LINE__) = metrics::Registry::global().timer(name); \
+    metrics::ScopedTimer METRICS_CONCAT(metricTimer, __LINE__)(METRICS_CONCAT(metricTimerId, __LINE__))
+#define METRICS_DUMP_AT_EXIT() metrics::dumpAtExit()
+
+#else
+
+#define METRIC_COUNT(name, n) do {} while (0)
+#define METRIC_TIMER(name) do {} while (0)
+#define METRICS_DUMP_AT_EXIT() do {} while (0)
+
+#endif
+
+#endif
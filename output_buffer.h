@@ -0,0 +1,80 @@
+#ifndef OUTPUT_BUFFER_H
+#define OUTPUT_BUFFER_H
+
+#include <charconv>
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+//Number formatting with to_chars, no streams or allocations. Doubles come out
+//the way an ostream with default settings prints them (6 significant digits).
+inline void appendNumber(std::string& out, double v) {
+    char buf[32];
+    auto r = std::to_chars(buf, buf + sizeof(buf), v, std::chars_format::general, 6);
+    out.append(buf, r.ptr);
+}
+
+//Collects text in a reusable buffer and hands it to an ostream in large writes
+//instead of one write per line. Besides explicit flush() calls, the policy
+//decides when the buffer is written out.
+class OutputBuffer {
+public:
+    enum FlushPolicy {
+        FLUSH_WHEN_FULL, //Once capacity bytes are waiting
+        FLUSH_MANUAL     //Only on flush(), the buffer grows as needed
+    };
+
+private:
+    std::ostream* os;
+    std::string buf; //Keeps its capacity across flushes
+    std::size_t capacity;
+    FlushPolicy policy;
+
+public:
+    explicit OutputBuffer(std::ostream& out = std::cout, FlushPolicy p = FLUSH_WHEN_FULL, std::size_t cap = 64 * 1024)
+        : os(&out), capacity(cap), policy(p) { buf.reserve(cap); }
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+    ~OutputBuffer() { flush(); }
+
+    void setPolicy(FlushPolicy p) { policy = p; commit(); }
+
+    OutputBuffer& operator<<(std::string_view s) { buf.append(s.data(), s.size()); return commit(); }
+    OutputBuffer& operator<<(char c) { buf.push_back(c); return commit(); }
+    OutputBuffer& operator<<(double v) { appendNumber(buf, v); return commit(); }
+    template <class T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, char>::value && !std::is_same<T, bool>::value, int>::type = 0>
+    OutputBuffer& operator<<(T v) {
+        char tmp[24];
+        auto r = std::to_chars(tmp, tmp + sizeof(tmp), v);
+        buf.append(tmp, r.ptr);
+        return commit();
+    }
+    OutputBuffer& endLine() {
+        buf.push_back('\n');
+        return commit();
+    }
+
+    //For formatters that append to the string directly, call commit() afterwards
+    std::string& text() { return buf; }
+    OutputBuffer& commit() {
+        if (policy == FLUSH_WHEN_FULL && buf.size() >= capacity) flush();
+        return *this;
+    }
+    void flush() {
+        if (!buf.empty()) {
+            os->write(buf.data(), buf.size());
+            buf.clear();
+        }
+        os->flush();
+    }
+};
+
+//Per-thread buffer writing to std::cout, flushed when the thread exits
+inline OutputBuffer& threadOutput() {
+    thread_local OutputBuffer out;
+    return out;
+}
+
+#endif
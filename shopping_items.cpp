@@ -3,18 +3,36 @@
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <charconv>
+#include <cmath>
+#include <mutex>
+#include "item_arena.h"
+#include "worker_pool.h"
+#include "journal.h"
+#include "metrics.h"
 using namespace std;
 
+//Whole-field number parsing with from_chars, false on anything left over
+inline bool parseDouble(string_view s, double& v) { //Also false on "nan" and "inf", which from_chars takes
+    auto r = from_chars(s.data(), s.data() + s.size(), v);
+    return r.ec == errc() && r.ptr == s.data() + s.size() && isfinite(v);
+}
+inline bool parseInt(string_view s, int& v) {
+    auto r = from_chars(s.data(), s.data() + s.size(), v);
+    return r.ec == errc() && r.ptr == s.data() + s.size();
+}
+
 //Parent class
 
 class Item {
 protected:
-    string name;
+    pmr::string name;
     double price;
 
 public:
     //Default
-    Item(const string& n = "", double p = 0.0) : name(n), price(p) {}
+    Item(string_view n = "", double p = 0.0, StringAllocator a = {}) : name(n, a), price(p) {}
 
     virtual ~Item() {} //Destructor to clean up resources
 
@@ -22,35 +40,34 @@ public:
         cout << "Name: " << name << " | Price: " << price;
     }
 
-    virtual void persist(ofstream& ofs) const = 0; //Each subclass will write itself to a file
-    virtual string getType() const = 0; //Returns a string identifier for the subclass
+    virtual void persist(ostream& ofs) const = 0; //Each subclass will write itself to a file
+    virtual int tag() const = 0; //Position of the subclass in RegisteredItems
+    string_view getType() const; //Returns the string identifier of the subclass
 };
 
 //Subclasses
 
 class Grocery : public Item {
-    string expirationDate;
+    pmr::string expirationDate;
 public:
-    Grocery(const string& n = "", double p = 0.0, const string& exp = "")
-        : Item(n, p), expirationDate(exp) {}
+    Grocery(string_view n = "", double p = 0.0, string_view exp = "", StringAllocator alloc = {})
+        : Item(n, p, alloc), expirationDate(exp, alloc) {}
 
     void display() const override {
         cout << "[Grocery] "; Item::display();
-        cout << " | Expiration: " << expirationDate << endl;
+        cout << " | Expiration: " << expirationDate << "\n";
     }
 
-    void persist(ofstream& ofs) const override {
-        ofs << "GROCERY|" << name << "|" << price << "|" << expirationDate << endl;
+    void persist(ostream& ofs) const override {
+        ofs << TYPE_NAME << "|" << name << "|" << price << "|" << expirationDate << "\n";
     }
 
-    string getType() const override { return "GROCERY"; }
+    static constexpr int TAG = 0;
+    static constexpr const char* TYPE_NAME = "GROCERY";
+    int tag() const override { return TAG; }
 
-    static Grocery* createFromLine(const string& line) { //Reads a line and returns a new Grocery object
-        stringstream ss(line);
-        string type, n, priceStr, exp;
-        getline(ss, type, '|'); getline(ss, n, '|');
-        getline(ss, priceStr, '|'); getline(ss, exp, '|');
-        return new Grocery(n, stod(priceStr), exp);
+    static Item* createFromFields(string_view n, double p, string_view exp, ItemArena& arena) { //Builds a Grocery from an already split line, placed in arena
+        return arena.make<Grocery>(n, p, exp);
     }
 };
 
@@ -58,177 +75,355 @@ public:
 class Electronics : public Item {
     int warrantyYears;
 public:
-    Electronics(const string& n = "", double p = 0.0, int w = 0)
-        : Item(n, p), warrantyYears(w) {}
+    Electronics(string_view n = "", double p = 0.0, int w = 0, StringAllocator alloc = {})
+        : Item(n, p, alloc), warrantyYears(w) {}
 
     void display() const override {
         cout << "[Electronics] "; Item::display();
-        cout << " | Warranty: " << warrantyYears << " years" << endl;
+        cout << " | Warranty: " << warrantyYears << " years\n";
     }
 
-    void persist(ofstream& ofs) const override {
-        ofs << "ELECTRONICS|" << name << "|" << price << "|" << warrantyYears << endl;
+    void persist(ostream& ofs) const override {
+        ofs << TYPE_NAME << "|" << name << "|" << price << "|" << warrantyYears << "\n";
     }
 
-    string getType() const override { return "ELECTRONICS"; }
+    static constexpr int TAG = 1;
+    static constexpr const char* TYPE_NAME = "ELECTRONICS";
+    int tag() const override { return TAG; }
 
-    static Electronics* createFromLine(const string& line) {
-        stringstream ss(line);
-        string type, n, priceStr, wStr;
-        getline(ss, type, '|'); getline(ss, n, '|');
-        getline(ss, priceStr, '|'); getline(ss, wStr, '|');
-        return new Electronics(n, stod(priceStr), stoi(wStr));
+    static Item* createFromFields(string_view n, double p, string_view wStr, ItemArena& arena) {
+        int w;
+        if (!parseInt(wStr, w)) return nullptr;
+        return arena.make<Electronics>(n, p, w);
     }
 };
 
 class Clothing : public Item {
-    string size;
+    pmr::string size;
 public:
-    Clothing(const string& n = "", double p = 0.0, const string& s = "")
-        : Item(n, p), size(s) {}
+    Clothing(string_view n = "", double p = 0.0, string_view s = "", StringAllocator alloc = {})
+        : Item(n, p, alloc), size(s, alloc) {}
 
     void display() const override {
         cout << "[Clothing] "; Item::display();
-        cout << " | Size: " << size << endl;
+        cout << " | Size: " << size << "\n";
     }
 
-    void persist(ofstream& ofs) const override {
-        ofs << "CLOTHING|" << name << "|" << price << "|" << size << endl;
+    void persist(ostream& ofs) const override {
+        ofs << TYPE_NAME << "|" << name << "|" << price << "|" << size << "\n";
     }
 
-    string getType() const override { return "CLOTHING"; }
+    static constexpr int TAG = 2;
+    static constexpr const char* TYPE_NAME = "CLOTHING";
+    int tag() const override { return TAG; }
 
-    static Clothing* createFromLine(const string& line) {
-        stringstream ss(line);
-        string type, n, priceStr, size;
-        getline(ss, type, '|'); getline(ss, n, '|');
-        getline(ss, priceStr, '|'); getline(ss, size, '|');
-        return new Clothing(n, stod(priceStr), size);
+    static Item* createFromFields(string_view n, double p, string_view size, ItemArena& arena) {
+        return arena.make<Clothing>(n, p, size);
     }
 };
 
 class Book : public Item {
-    string author;
+    pmr::string author;
 public:
-    Book(const string& n = "", double p = 0.0, const string& a = "")
-        : Item(n, p), author(a) {}
+    Book(string_view n = "", double p = 0.0, string_view a = "", StringAllocator alloc = {})
+        : Item(n, p, alloc), author(a, alloc) {}
 
     void display() const override {
         cout << "[Book] "; Item::display();
-        cout << " | Author: " << author << endl;
+        cout << " | Author: " << author << "\n";
     }
 
-    void persist(ofstream& ofs) const override {
-        ofs << "BOOK|" << name << "|" << price << "|" << author << endl;
+    void persist(ostream& ofs) const override {
+        ofs << TYPE_NAME << "|" << name << "|" << price << "|" << author << "\n";
     }
 
-    string getType() const override { return "BOOK"; }
+    static constexpr int TAG = 3;
+    static constexpr const char* TYPE_NAME = "BOOK";
+    int tag() const override { return TAG; }
 
-    static Book* createFromLine(const string& line) {
-        stringstream ss(line);
-        string type, n, priceStr, author;
-        getline(ss, type, '|'); getline(ss, n, '|');
-        getline(ss, priceStr, '|'); getline(ss, author, '|');
-        return new Book(n, stod(priceStr), author);
+    static Item* createFromFields(string_view n, double p, string_view author, ItemArena& arena) {
+        return arena.make<Book>(n, p, author);
     }
 };
 
 class Toy : public Item {
     int recommendedAge;
 public:
-    Toy(const string& n = "", double p = 0.0, int age = 0)
-        : Item(n, p), recommendedAge(age) {}
+    Toy(string_view n = "", double p = 0.0, int age = 0, StringAllocator alloc = {})
+        : Item(n, p, alloc), recommendedAge(age) {}
 
     void display() const override {
         cout << "[Toy] "; Item::display();
-        cout << " | Recommended Age: " << recommendedAge << "+" << endl;
+        cout << " | Recommended Age: " << recommendedAge << "+\n";
     }
 
-    void persist(ofstream& ofs) const override {
-        ofs << "TOY|" << name << "|" << price << "|" << recommendedAge << endl;
+    void persist(ostream& ofs) const override {
+        ofs << TYPE_NAME << "|" << name << "|" << price << "|" << recommendedAge << "\n";
     }
 
-    string getType() const override { return "TOY"; }
+    static constexpr int TAG = 4;
+    static constexpr const char* TYPE_NAME = "TOY";
+    int tag() const override { return TAG; }
 
-    static Toy* createFromLine(const string& line) {
-        stringstream ss(line);
-        string type, n, priceStr, ageStr;
-        getline(ss, type, '|'); getline(ss, n, '|');
-        getline(ss, priceStr, '|'); getline(ss, ageStr, '|');
-        return new Toy(n, stod(priceStr), stoi(ageStr));
+    static Item* createFromFields(string_view n, double p, string_view ageStr, ItemArena& arena) {
+        int age;
+        if (!parseInt(ageStr, age)) return nullptr;
+        return arena.make<Toy>(n, p, age);
     }
 };
 
+//Type registry built at compile time from each subclass's TAG, TYPE_NAME and
+//createFromFields. parseLine looks types up here, so adding a subclass only means
+//adding it to RegisteredItems.
+struct ItemTypeInfo {
+    string_view name;
+    Item* (*createFromFields)(string_view n, double p, string_view field, ItemArena& arena);
+};
+
+template <class... Ts> struct ItemTypeList {
+    static constexpr int COUNT = sizeof...(Ts);
+    static constexpr ItemTypeInfo table[COUNT] = { { Ts::TYPE_NAME, &Ts::createFromFields }... };
+    static constexpr bool inTagOrder() { int i = 0; return ((Ts::TAG == i++) && ...); }
+};
+
+typedef ItemTypeList<Grocery, Electronics, Clothing, Book, Toy> RegisteredItems;
+static_assert(RegisteredItems::inTagOrder(), "RegisteredItems must list the subclasses in TAG order");
+
+inline const ItemTypeInfo* findItemType(string_view name) {
+    for (const auto& t : RegisteredItems::table) if (t.name == name) return &t;
+    return nullptr;
+}
+string_view Item::getType() const { return RegisteredItems::table[tag()].name; }
+
+//Problem found while restoring, line numbers start at 1
+struct RestoreError {
+    size_t line;
+    string message;
+};
+
+//Parses one "TYPE|name|price|field" line without allocating, error is set when it returns nullptr.
+//The field is the rest of the line, bars included, as in shopping_items_updated.cpp.
+Item* parseLine(string_view line, ItemArena& arena, string& error) {
+    string_view f[4];
+    size_t count = 0;
+    while (count < 4) {
+        size_t bar = count < 3 ? line.find('|') : string_view::npos;
+        f[count++] = line.substr(0, bar);
+        if (bar == string_view::npos) break;
+        line.remove_prefix(bar + 1);
+    }
+    if (count < 4) { error = "expected TYPE|name|price|field, got " + to_string(count) + " field(s)"; return nullptr; }
+    double p;
+    if (!parseDouble(f[2], p)) { error = "bad price '" + string(f[2]) + "'"; return nullptr; }
+
+    const ItemTypeInfo* type = findItemType(f[0]);
+    if (!type) { error = "unknown type '" + string(f[0]) + "'"; return nullptr; }
+    Item* item = type->createFromFields(f[1], p, f[3], arena);
+    if (!item) error = "bad number '" + string(f[3]) + "'";
+    return item;
+}
+
+//Parses the lines of text on pool, each task into its own arena shard, and appends
+//the items to items in text order. Malformed lines go to errors numbered from
+//firstLine, lines starting with '#' are comments. Returns the number of lines.
+size_t parseLines(string_view text, WorkerPool& pool, ItemArena& arena, vector<Item*>& items,
+                  vector<RestoreError>* errors, size_t firstLine = 1) {
+    struct Chunk {
+        size_t begin, end, lines = 0;
+        vector<Item*> items;
+        vector<RestoreError> errors; //Line numbers relative to the chunk
+    };
+    const size_t MIN_CHUNK = 1 << 16; //Smaller texts are not worth splitting
+    size_t nChunks = max<size_t>(1, min<size_t>(pool.size() * 4, text.size() / MIN_CHUNK));
+    vector<Chunk> chunks;
+    for (size_t c = 0, begin = 0; c < nChunks && begin < text.size(); ++c) {
+        size_t end = c + 1 == nChunks ? string::npos : text.find('\n', max(begin, text.size() * (c + 1) / nChunks));
+        end = end == string::npos ? text.size() : end + 1;
+        chunks.push_back(Chunk{ begin, end, 0, {}, {} });
+        begin = end;
+    }
+
+    parallelFor(pool, chunks.size(), [&](size_t, size_t first, size_t last) {
+        ItemArena& shard = arena.shard(); //ItemArena is not thread-safe, so each task gets its own
+        string error;
+        for (size_t c = first; c < last; ++c) {
+            Chunk& ch = chunks[c];
+            string_view rest = text.substr(ch.begin, ch.end - ch.begin);
+            while (!rest.empty()) {
+                size_t nl = rest.find('\n');
+                string_view line = rest.substr(0, nl);
+                rest.remove_prefix(nl == string_view::npos ? rest.size() : nl + 1);
+                ++ch.lines;
+                if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+                if (line.empty() || line[0] == '#') continue;
+                if (Item* item = parseLine(line, shard, error)) ch.items.push_back(item);
+                else ch.errors.push_back(RestoreError{ ch.lines, error });
+            }
+            METRIC_COUNT("records_parsed", ch.items.size());
+            METRIC_COUNT("parse_errors", ch.errors.size());
+        }
+    });
+
+    size_t total = 0, lineBase = firstLine - 1;
+    for (auto& ch : chunks) total += ch.items.size();
+    items.reserve(items.size() + total);
+    for (auto& ch : chunks) {
+        items.insert(items.end(), ch.items.begin(), ch.items.end());
+        if (errors)
+            for (auto& e : ch.errors) errors->push_back(RestoreError{ lineBase + e.line, move(e.message) });
+        lineBase += ch.lines;
+    }
+    return lineBase - (firstLine - 1);
+}
+
 //Restore function
-vector<Item*> restore(const string& filename) { //Reads the file line by line, reads the type identifier, calls createfromLine() and returns the items
+//Reads the whole file and parses it on a pool of threads with parseLines(). A
+//leading "#SEQ|n" line gives the last journal record the file already contains
+//(0 when absent).
+vector<Item*> restore(const string& filename, ItemArena& arena, vector<RestoreError>* errors = nullptr, unsigned threads = 0,
+                      uint64_t* journalSeq = nullptr) {
     vector<Item*> items;
-    ifstream ifs(filename);
+    if (journalSeq) *journalSeq = 0;
+    ifstream ifs(filename, ios::binary | ios::ate);
     if (!ifs) return items;
-
-    string line;
-    while (getline(ifs, line)) {
-        stringstream ss(line);
-        string type;
-        getline(ss, type, '|');
-
-        if (type == "GROCERY") items.push_back(Grocery::createFromLine(line));
-        else if (type == "ELECTRONICS") items.push_back(Electronics::createFromLine(line));
-        else if (type == "CLOTHING") items.push_back(Clothing::createFromLine(line));
-        else if (type == "BOOK") items.push_back(Book::createFromLine(line));
-        else if (type == "TOY") items.push_back(Toy::createFromLine(line));
+    METRIC_TIMER("restore");
+    string text((size_t)ifs.tellg(), '\0');
+    ifs.seekg(0);
+    ifs.read(&text[0], text.size());
+    METRIC_COUNT("bytes_read", text.size());
+    if (journalSeq && text.compare(0, 5, "#SEQ|") == 0) {
+        size_t nl = text.find('\n');
+        from_chars(text.data() + 5, text.data() + (nl == string::npos ? text.size() : nl), *journalSeq);
     }
+    WorkerPool pool(text.size() < (1 << 16) ? 1 : threads);
+    parseLines(text, pool, arena, items, errors);
     return items;
 }
 
+//Bulk ingest of TYPE|name|price|field lines from in, which may be a pipe. The
+//input is read in large blocks of whole lines, each parsed in parallel, and the
+//new items are appended to items. Bad lines end up in rejects, the rest still
+//go in. Returns the number of items added.
+size_t ingest(istream& in, ItemArena& arena, vector<Item*>& items, vector<RestoreError>& rejects, unsigned threads = 0) {
+    METRIC_TIMER("ingest");
+    const size_t BLOCK = 4 << 20;
+    WorkerPool pool(threads);
+    size_t before = items.size(), line = 1;
+    string block, carry;
+    while (in || !carry.empty()) {
+        block = move(carry);
+        carry.clear();
+        size_t old = block.size();
+        if (in) {
+            block.resize(old + BLOCK);
+            in.read(&block[old], BLOCK);
+            block.resize(old + (size_t)in.gcount());
+            if (in) { //A partial last line waits for the next block
+                size_t nl = block.rfind('\n');
+                if (nl == string::npos) { carry = move(block); continue; }
+                carry.assign(block, nl + 1, string::npos);
+                block.resize(nl + 1);
+            }
+        }
+        line += parseLines(block, pool, arena, items, &rejects, line);
+    }
+    return items.size() - before;
+}
+
+//Items file contents covering the journal up to seq
+string snapshotText(const vector<Item*>& items, uint64_t seq) {
+    ostringstream os;
+    os << "#SEQ|" << seq << "\n";
+    for (auto* item : items) item->persist(os);
+    return os.str();
+}
+
+#ifndef SHOPPING_ITEMS_NO_MAIN
 //Main program
-int main() {
-    vector<Item*> items = restore("items.txt"); //Loads any previously saved items
+int main(int argc, char* argv[]) {
+    METRICS_DUMP_AT_EXIT();
+    ItemArena arena; //Owns every item, released in one go when main returns
+    vector<RestoreError> errors;
+    uint64_t snapshotSeq;
+    vector<Item*> items = restore("items.txt", arena, &errors, 0, &snapshotSeq); //Loads any previously saved items
+    for (const auto& e : errors) cerr << "items.txt:" << e.line << ": " << e.message << ", line skipped\n";
+
+    //Items added after the last save are replayed from the journal, each record is one items.txt line
+    Journal journal;
+    size_t replayed = 0;
+    journal.open("items.txt.wal", snapshotSeq, [&](uint64_t, string_view line) {
+        string error;
+        if (Item* item = parseLine(line, arena, error)) { items.push_back(item); ++replayed; }
+        else cerr << "items.txt.wal: " << error << ", record skipped\n";
+    });
+
+    //shopping_items --ingest <file|->: adds TYPE|name|price|field lines from a file or stdin, saves and exits
+    if (argc == 3 && string(argv[1]) == "--ingest") {
+        string source = argv[2];
+        ifstream file;
+        if (source != "-") {
+            file.open(source, ios::binary);
+            if (!file) { cerr << "Cannot open " << source << "\n"; return 1; }
+        }
+        vector<RestoreError> rejects;
+        size_t added = ingest(source == "-" ? cin : file, arena, items, rejects);
+        for (const auto& e : rejects) cerr << source << ":" << e.line << ": " << e.message << ", record rejected\n";
+        journal.compact(journal.lastSeq(), snapshotText(items, journal.lastSeq()), "items.txt"); //One save for the whole batch
+        bool saved = journal.close();
+        cout << "Added " << added << " item(s), rejected " << rejects.size() << "\n";
+        if (!saved) cerr << "Could not save items.txt\n";
+        return saved ? 0 : 1;
+    }
+
+    cout << "Restored " << items.size() << " item(s) from file";
+    if (replayed) cout << " (" << replayed << " from items.txt.wal)";
+    cout << ".\n";
 
-    cout << "Restored " << items.size() << " item(s) from file.\n";
+    //The journal's thread compacts into items.txt when due, the menu adds items under catalog
+    mutex catalog;
+    journal.setCompactionHandler([&] {
+        lock_guard<mutex> lock(catalog);
+        journal.compact(journal.lastSeq(), snapshotText(items, journal.lastSeq()), "items.txt");
+    });
 
     while (true) {
         cout << "\n1. Add Grocery\n2. Add Electronics\n3. Add Clothing\n4. Add Book\n5. Add Toy\n6. Display All\n7. Save & Exit\nChoice: "; //Menu
         int choice;
-        cin >> choice;
-        if (choice == 7) break;
+        if (!(cin >> choice) || choice == 7) break; //End of input saves as well
 
         string name;
         double price;
+        Item* added = nullptr;
 
         switch (choice) { //Menu choices
             case 1: {
                 string exp;
                 cout << "Enter name, price, expiration: ";
-                cin >> name >> price >> exp;
-                items.push_back(new Grocery(name, price, exp));
+                if (cin >> name >> price >> exp) added = arena.make<Grocery>(name, price, exp);
                 break;
             }
             case 2: {
                 int w;
                 cout << "Enter name, price, warranty years: ";
-                cin >> name >> price >> w;
-                items.push_back(new Electronics(name, price, w));
+                if (cin >> name >> price >> w) added = arena.make<Electronics>(name, price, w);
                 break;
             }
             case 3: {
                 string size;
                 cout << "Enter name, price, size: ";
-                cin >> name >> price >> size;
-                items.push_back(new Clothing(name, price, size));
+                if (cin >> name >> price >> size) added = arena.make<Clothing>(name, price, size);
                 break;
             }
             case 4: {
                 string author;
                 cout << "Enter name, price, author: ";
-                cin >> name >> price >> author;
-                items.push_back(new Book(name, price, author));
+                if (cin >> name >> price >> author) added = arena.make<Book>(name, price, author);
                 break;
             }
             case 5: {
                 int age;
                 cout << "Enter name, price, recommended age: ";
-                cin >> name >> price >> age;
-                items.push_back(new Toy(name, price, age));
+                if (cin >> name >> price >> age) added = arena.make<Toy>(name, price, age);
                 break;
             }
             case 6:
@@ -237,19 +432,26 @@ int main() {
             default:
                 cout << "Invalid choice.\n";
         }
+        if (!cin) break; //A half-read item is neither kept nor logged
+        if (added) { //Log the new item right away
+            ostringstream line;
+            added->persist(line);
+            string rec = line.str();
+            rec.pop_back(); //Drop the newline
+            lock_guard<mutex> lock(catalog);
+            items.push_back(added);
+            if (!journal.append(rec)) cerr << "Cannot write items.txt.wal, the item is only saved on exit\n";
+        }
     }
 
-    ofstream ofs("items.txt");
-    for (auto* item : items)
-        item->persist(ofs);
-    ofs.close();
-
-    for (auto* item : items)
-        delete item;
+    journal.setCompactionHandler(nullptr);
+    journal.compact(journal.lastSeq(), snapshotText(items, journal.lastSeq()), "items.txt");
+    if (!journal.close()) {
+        cerr << "Could not save items.txt, items added since the last save may be lost\n";
+        return 1;
+    }
 
     cout << "Saved all items to items.txt\n";
-
-    //Saves all items and deletes all dynamically allocated memory to prevent memory leaks
-    
     return 0;
 }
+#endif
@@ -3,23 +3,119 @@
 #include <memory>
 #include <fstream>
 #include <queue>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <climits>
 #include <string>
+#include <string_view>
+#include <cstring>
+#include <cctype>
+#include <cstdint>
+#include <charconv>
+#include <type_traits>
+#include <unordered_map>
+#include <map>
+#include <mutex>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <ctime>
+#include <functional>
+#include <thread>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "item_arena.h"
+#include "journal.h"
+#include "worker_pool.h"
+#include "output_buffer.h"
+#include "string_pool.h"
+#include "async_file.h"
+#include "metrics.h"
+#include "lz_codec.h"
+#include "snapshot_cell.h"
 using namespace std;
 
+//One byte type tag, also used as the on-disk tag of the columnar format. Each
+//subclass registers its tag in RegisteredItems below.
+enum class ItemKind : uint8_t { Grocery, Electronics, Clothing, Book, Toy };
+
+//Calendar date packed into 32 bits as yyyymmdd, so dates order like integers.
+//The default Date is invalid and sorts before every real date.
+class Date {
+    uint32_t ymd = 0;
+public:
+    Date() = default;
+    Date(int y, int m, int d) : ymd((uint32_t)(y * 10000 + m * 100 + d)) {}
+    static Date parse(string_view s) { //YYYY-MM-DD, anything else gives an invalid Date
+        int y, m, d;
+        auto part = [&](size_t at, size_t len, int& v) {
+            auto r = from_chars(s.data() + at, s.data() + at + len, v);
+            return r.ec == errc() && r.ptr == s.data() + at + len;
+        };
+        if (s.size() != 10 || s[4] != '-' || s[7] != '-') return Date();
+        if (!part(0, 4, y) || !part(5, 2, m) || !part(8, 2, d)) return Date();
+        if (y < 1 || m < 1 || m > 12 || d < 1 || d > 31) return Date();
+        return Date(y, m, d);
+    }
+    static Date today() { //Local calendar date
+        time_t now = time(nullptr);
+        tm local{};
+#ifdef _WIN32
+        localtime_s(&local, &now);
+#else
+        localtime_r(&now, &local);
+#endif
+        return Date(local.tm_year + 1900, local.tm_mon + 1, local.tm_mday);
+    }
+    bool valid() const { return ymd != 0; }
+    uint32_t packed() const { return ymd; }
+    int year() const { return (int)(ymd / 10000); }
+    int month() const { return (int)(ymd / 100 % 100); }
+    int day() const { return (int)(ymd % 100); }
+    bool operator==(Date o) const { return ymd == o.ymd; }
+    bool operator!=(Date o) const { return ymd != o.ymd; }
+    bool operator<(Date o) const { return ymd < o.ymd; }
+    bool operator<=(Date o) const { return ymd <= o.ymd; }
+};
+
+class BinaryStringTable;
+
 //Parent class
 class Item {
 protected: //Common properties
-    string name;
+    pmr::string name;
     double price;
+
+    template <class T> static void put(string& out, T v) { out.append((const char*)&v, sizeof(v)); }
+    void persistCommon(string& out) const { //Type tag, name and price of a binary record
+        put(out, (uint8_t)kind());
+        put(out, name.size()); out.append(name.data(), name.size());
+        put(out, price);
+    }
 public:
-    Item(const string& n = "", double p = 0.0) : name(n), price(p) {}
+    Item(string_view n = "", double p = 0.0, StringAllocator a = {}) : name(n, a), price(p) {}
     virtual ~Item() = default;
 
-    virtual void display() const = 0;
-    virtual string getType() const = 0;
+    virtual void format(OutputBuffer& out) const = 0; //Appends the display line to out
+    void display() const { //Prints the item right away
+        OutputBuffer& out = threadOutput();
+        format(out);
+        out.flush();
+    }
+    string_view getType() const; //Registered name of the subclass, no allocation
+    virtual ItemKind kind() const = 0;
+
+    string_view getName() const { return name; }
+    double getPrice() const { return price; }
 
-    virtual void persistBinary(ofstream& ofs) const = 0;
-    static unique_ptr<Item> restoreBinary(ifstream& ifs);
+    //Appends the binary record to out, strings go to the file's string table (see BinaryStringTable)
+    virtual void persistBinary(string& out, BinaryStringTable& strings) const = 0;
 
     bool operator<(const Item& other) const { return price < other.price; }
 
@@ -27,179 +123,2326 @@ public:
     friend istream& operator>>(istream& is, unique_ptr<Item>& item);
 };
 
+//String table of an items.bin file. Records store a u32 index into it in place
+//of the expiry, size or author text, so every distinct value is written once per
+//file. The file layout is
+//  "IBIN" | records | u32 count | count x (u32 length | bytes) | u64 record count | u64 table offset | "IBIN"
+class BinaryStringTable {
+    unordered_map<uint32_t, uint32_t> fileIndex; //Pool handle to index in this file
+    vector<InternedString> strings;
+public:
+    static constexpr char MAGIC[4] = { 'I', 'B', 'I', 'N' };
+    static constexpr size_t FOOTER = 20; //Record count, table offset and magic
+
+    uint32_t add(InternedString s) { //Index of s in the file, adding it on first use
+        auto r = fileIndex.emplace(s.handle(), (uint32_t)strings.size());
+        if (r.second) strings.push_back(s);
+        return r.first->second;
+    }
+    size_t size() const { return strings.size(); }
+
+    vector<string_view> views() const {
+        vector<string_view> v;
+        v.reserve(strings.size());
+        for (InternedString s : strings) v.push_back(s.view());
+        return v;
+    }
+
+    static void writeHeader(AsyncFileWriter& w) { w.write(string_view(MAGIC, 4)); }
+    void writeFooter(AsyncFileWriter& w, uint64_t recordCount) const { writeFooter(w, views(), recordCount); }
+    void writeTable(AsyncFileWriter& w) const { writeTable(w, views()); }
+    //Same for a table kept somewhere else, such as a LocalStringTable
+    static void writeFooter(AsyncFileWriter& w, const vector<string_view>& strings, uint64_t recordCount) {
+        uint64_t offset = w.position();
+        writeTable(w, strings);
+        w.buffer().append((char*)&recordCount, sizeof(recordCount));
+        w.buffer().append((char*)&offset, sizeof(offset));
+        w.write(string_view(MAGIC, 4));
+    }
+    static void writeTable(AsyncFileWriter& w, const vector<string_view>& strings) { //u32 count, then every string
+        uint32_t n = (uint32_t)strings.size();
+        w.write(string_view((char*)&n, sizeof(n)));
+        for (string_view v : strings) {
+            uint32_t len = (uint32_t)v.size();
+            w.buffer().append((char*)&len, sizeof(len));
+            w.write(v);
+        }
+    }
+    //Finds the footer of an interned file of the given size, false for anything else
+    static bool locate(const char* begin, size_t size, uint64_t& recordCount, uint64_t& tableOffset) {
+        if (size < 4 + 4 + FOOTER || memcmp(begin, MAGIC, 4) != 0 || memcmp(begin + size - 4, MAGIC, 4) != 0) return false;
+        memcpy(&recordCount, begin + size - FOOTER, 8);
+        memcpy(&tableOffset, begin + size - FOOTER + 8, 8);
+        return tableOffset >= 4 && tableOffset <= size - FOOTER - 4;
+    }
+};
+
 //Sub classes
 class Grocery : public Item {
-    string expiry;
+    InternedString expiry; //Text as entered, shared with every other item of that date
+    Date expiryDate;       //Same date for comparisons, invalid if the text is not YYYY-MM-DD
 public:
-    Grocery(const string& n = "", double p = 0.0, const string& e = "") : Item(n, p), expiry(e) {}
-    void display() const override {
-        cout << "Grocery - " << name << " (€" << price << ") Exp: " << expiry << endl; //Prints item info
-    }
-    string getType() const override { return "Grocery"; } //Returns type as string
-    void persistBinary(ofstream& ofs) const override { //Save object fields to binary
-        size_t len = name.size(); ofs.write((char*)&len, sizeof(len)); ofs.write(name.c_str(), len);
-        ofs.write((char*)&price, sizeof(price));
-        len = expiry.size(); ofs.write((char*)&len, sizeof(len)); ofs.write(expiry.c_str(), len);
+    Grocery(string_view n = "", double p = 0.0, string_view e = "", StringAllocator alloc = {})
+        : Item(n, p, alloc), expiry(e), expiryDate(Date::parse(e)) {}
+    void format(OutputBuffer& out) const override { //Item info as one line
+        out << "Grocery - " << name << " (€" << price << ") Exp: " << expiry.view();
+        out.endLine();
     }
-    static unique_ptr<Item> restoreBinary(ifstream& ifs) { //Restores object fields from binary
-        size_t len; string n, e; double p;
-        ifs.read((char*)&len, sizeof(len)); n.resize(len); ifs.read(&n[0], len);
-        ifs.read((char*)&p, sizeof(p));
-        ifs.read((char*)&len, sizeof(len)); e.resize(len); ifs.read(&e[0], len);
-        return make_unique<Grocery>(n, p, e);
+    static constexpr ItemKind TAG = ItemKind::Grocery;
+    static constexpr const char* TYPE_NAME = "Grocery";
+    typedef string_view Field; //Type of the one field the subclass adds
+    Field field() const { return expiry.view(); }
+    ItemKind kind() const override { return TAG; }
+    string_view getExpiry() const { return expiry.view(); }
+    InternedString getExpiryId() const { return expiry; }
+    Date getExpiryDate() const { return expiryDate; }
+    void persistBinary(string& out, BinaryStringTable& strings) const override { //Save object fields to binary
+        persistCommon(out);
+        put(out, strings.add(expiry));
     }
 };
 
 class Electronics : public Item {
     int warranty;
 public:
-    Electronics(const string& n = "", double p = 0.0, int w = 0) : Item(n, p), warranty(w) {}
-    void display() const override {
-        cout << "Electronics - " << name << " (€" << price << ") Warranty: " << warranty << "y" << endl;
-    }
-    string getType() const override { return "Electronics"; }
-    void persistBinary(ofstream& ofs) const override {
-        size_t len = name.size(); ofs.write((char*)&len, sizeof(len)); ofs.write(name.c_str(), len);
-        ofs.write((char*)&price, sizeof(price));
-        ofs.write((char*)&warranty, sizeof(warranty));
+    Electronics(string_view n = "", double p = 0.0, int w = 0, StringAllocator alloc = {}) : Item(n, p, alloc), warranty(w) {}
+    void format(OutputBuffer& out) const override {
+        out << "Electronics - " << name << " (€" << price << ") Warranty: " << warranty << "y";
+        out.endLine();
     }
-    static unique_ptr<Item> restoreBinary(ifstream& ifs) {
-        size_t len; string n; double p; int w;
-        ifs.read((char*)&len, sizeof(len)); n.resize(len); ifs.read(&n[0], len);
-        ifs.read((char*)&p, sizeof(p));
-        ifs.read((char*)&w, sizeof(w));
-        return make_unique<Electronics>(n, p, w);
+    static constexpr ItemKind TAG = ItemKind::Electronics;
+    static constexpr const char* TYPE_NAME = "Electronics";
+    typedef int Field; //Type of the one field the subclass adds
+    Field field() const { return warranty; }
+    ItemKind kind() const override { return TAG; }
+    int getWarranty() const { return warranty; }
+    void persistBinary(string& out, BinaryStringTable&) const override {
+        persistCommon(out);
+        put(out, warranty);
     }
 };
 
 class Clothing : public Item {
-    string size;
+    InternedString size;
 public:
-    Clothing(const string& n = "", double p = 0.0, const string& s = "") : Item(n, p), size(s) {}
-    void display() const override {
-        cout << "Clothing - " << name << " (€" << price << ") Size: " << size << endl;
+    Clothing(string_view n = "", double p = 0.0, string_view s = "", StringAllocator alloc = {})
+        : Item(n, p, alloc), size(s) {}
+    void format(OutputBuffer& out) const override {
+        out << "Clothing - " << name << " (€" << price << ") Size: " << size.view();
+        out.endLine();
     }
-    string getType() const override { return "Clothing"; }
-    void persistBinary(ofstream& ofs) const override {
-        size_t len = name.size(); ofs.write((char*)&len, sizeof(len)); ofs.write(name.c_str(), len);
-        ofs.write((char*)&price, sizeof(price));
-        len = size.size(); ofs.write((char*)&len, sizeof(len)); ofs.write(size.c_str(), len);
-    }
-    static unique_ptr<Item> restoreBinary(ifstream& ifs) {
-        size_t len; string n, s; double p;
-        ifs.read((char*)&len, sizeof(len)); n.resize(len); ifs.read(&n[0], len);
-        ifs.read((char*)&p, sizeof(p));
-        ifs.read((char*)&len, sizeof(len)); s.resize(len); ifs.read(&s[0], len);
-        return make_unique<Clothing>(n, p, s);
+    static constexpr ItemKind TAG = ItemKind::Clothing;
+    static constexpr const char* TYPE_NAME = "Clothing";
+    typedef string_view Field; //Type of the one field the subclass adds
+    Field field() const { return size.view(); }
+    ItemKind kind() const override { return TAG; }
+    string_view getSize() const { return size.view(); }
+    InternedString getSizeId() const { return size; }
+    void persistBinary(string& out, BinaryStringTable& strings) const override {
+        persistCommon(out);
+        put(out, strings.add(size));
     }
 };
 
 class Book : public Item {
-    string author;
+    InternedString author;
 public:
-    Book(const string& n = "", double p = 0.0, const string& a = "") : Item(n, p), author(a) {}
-    void display() const override {
-        cout << "Book - " << name << " (€" << price << ") Author: " << author << endl;
-    }
-    string getType() const override { return "Book"; }
-    void persistBinary(ofstream& ofs) const override {
-        size_t len = name.size(); ofs.write((char*)&len, sizeof(len)); ofs.write(name.c_str(), len);
-        ofs.write((char*)&price, sizeof(price));
-        len = author.size(); ofs.write((char*)&len, sizeof(len)); ofs.write(author.c_str(), len);
+    Book(string_view n = "", double p = 0.0, string_view a = "", StringAllocator alloc = {})
+        : Item(n, p, alloc), author(a) {}
+    void format(OutputBuffer& out) const override {
+        out << "Book - " << name << " (€" << price << ") Author: " << author.view();
+        out.endLine();
     }
-    static unique_ptr<Item> restoreBinary(ifstream& ifs) {
-        size_t len; string n, a; double p;
-        ifs.read((char*)&len, sizeof(len)); n.resize(len); ifs.read(&n[0], len);
-        ifs.read((char*)&p, sizeof(p));
-        ifs.read((char*)&len, sizeof(len)); a.resize(len); ifs.read(&a[0], len);
-        return make_unique<Book>(n, p, a);
+    static constexpr ItemKind TAG = ItemKind::Book;
+    static constexpr const char* TYPE_NAME = "Book";
+    typedef string_view Field; //Type of the one field the subclass adds
+    Field field() const { return author.view(); }
+    ItemKind kind() const override { return TAG; }
+    string_view getAuthor() const { return author.view(); }
+    InternedString getAuthorId() const { return author; }
+    void persistBinary(string& out, BinaryStringTable& strings) const override {
+        persistCommon(out);
+        put(out, strings.add(author));
     }
 };
 
 class Toy : public Item {
     int recommendedAge;
 public:
-    Toy(const string& n = "", double p = 0.0, int age = 0) : Item(n, p), recommendedAge(age) {}
-    void display() const override {
-        cout << "Toy - " << name << " (€" << price << ") Recommended Age: " << recommendedAge << "+" << endl;
-    }
-    string getType() const override { return "Toy"; }
-    void persistBinary(ofstream& ofs) const override {
-        size_t len = name.size(); ofs.write((char*)&len, sizeof(len)); ofs.write(name.c_str(), len);
-        ofs.write((char*)&price, sizeof(price));
-        ofs.write((char*)&recommendedAge, sizeof(recommendedAge));
-    }
-    static unique_ptr<Item> restoreBinary(ifstream& ifs) {
-        size_t len; string n; double p; int age;
-        ifs.read((char*)&len, sizeof(len)); n.resize(len); ifs.read(&n[0], len);
-        ifs.read((char*)&p, sizeof(p));
-        ifs.read((char*)&age, sizeof(age));
-        return make_unique<Toy>(n, p, age);
-    }
-};
-
-//Factory function
-unique_ptr<Item> Item::restoreBinary(ifstream& ifs) { //Reads item type from file
-    string type; size_t len;
-    ifs.read((char*)&len, sizeof(len));
-    if (!ifs) return nullptr;
-    type.resize(len); ifs.read(&type[0], len);
-
-    if (type == "Grocery") return Grocery::restoreBinary(ifs);
-    if (type == "Electronics") return Electronics::restoreBinary(ifs);
-    if (type == "Clothing") return Clothing::restoreBinary(ifs);
-    if (type == "Book") return Book::restoreBinary(ifs);
-    if (type == "Toy") return Toy::restoreBinary(ifs);
-    return nullptr;
+    Toy(string_view n = "", double p = 0.0, int age = 0, StringAllocator alloc = {}) : Item(n, p, alloc), recommendedAge(age) {}
+    void format(OutputBuffer& out) const override {
+        out << "Toy - " << name << " (€" << price << ") Recommended Age: " << recommendedAge << "+";
+        out.endLine();
+    }
+    static constexpr ItemKind TAG = ItemKind::Toy;
+    static constexpr const char* TYPE_NAME = "Toy";
+    typedef int Field; //Type of the one field the subclass adds
+    Field field() const { return recommendedAge; }
+    ItemKind kind() const override { return TAG; }
+    int getRecommendedAge() const { return recommendedAge; }
+    void persistBinary(string& out, BinaryStringTable&) const override {
+        persistCommon(out);
+        put(out, recommendedAge);
+    }
+};
+
+//Type registry, one entry per subclass built at compile time from its TAG, TYPE_NAME
+//and Field. Factories and loaders index it by tag, so a new item type only needs its
+//ItemKind value, its class and a place in RegisteredItems.
+struct ItemTypeInfo {
+    string_view name;
+    bool hasText; //Field is a string, otherwise an int
+    unique_ptr<Item> (*make)(string_view name, double price, string_view text, int number);
+    Item* (*makeIn)(ItemArena& arena, string_view name, double price, string_view text, int number);
+    void (*fields)(const Item& item, string_view& text, int& number);
+};
+
+template <class T> struct ItemTypeEntry {
+    static constexpr bool HAS_TEXT = !is_same<typename T::Field, int>::value;
+    static typename T::Field pick(string_view text, int number) {
+        if constexpr (HAS_TEXT) return text; else return number;
+    }
+    static unique_ptr<Item> make(string_view n, double p, string_view text, int number) { return make_unique<T>(n, p, pick(text, number)); }
+    static Item* makeIn(ItemArena& a, string_view n, double p, string_view text, int number) { return a.make<T>(n, p, pick(text, number)); }
+    static void fields(const Item& i, string_view& text, int& number) {
+        if constexpr (HAS_TEXT) { text = static_cast<const T&>(i).field(); number = 0; }
+        else { number = static_cast<const T&>(i).field(); text = string_view(); }
+    }
+    static constexpr ItemTypeInfo info = { T::TYPE_NAME, HAS_TEXT, &make, &makeIn, &fields };
+};
+
+template <class... Ts> struct ItemTypeList {
+    static constexpr int COUNT = sizeof...(Ts);
+    static constexpr ItemTypeInfo table[COUNT] = { ItemTypeEntry<Ts>::info... };
+    static constexpr bool inTagOrder() { int i = 0; return (((int)Ts::TAG == i++) && ...); }
+};
+
+typedef ItemTypeList<Grocery, Electronics, Clothing, Book, Toy> RegisteredItems;
+static_assert(RegisteredItems::inTagOrder(), "RegisteredItems must list the subclasses in ItemKind order");
+
+const int ITEM_KIND_COUNT = RegisteredItems::COUNT;
+inline const ItemTypeInfo& itemType(ItemKind k) { return RegisteredItems::table[(int)k]; }
+inline bool kindHasText(ItemKind k) { return itemType(k).hasText; }
+inline bool kindFromName(string_view s, ItemKind& k) { //Case-insensitive so "Grocery" and "GROCERY" both match
+    for (int i = 0; i < ITEM_KIND_COUNT; ++i) {
+        string_view n = RegisteredItems::table[i].name;
+        if (n.size() != s.size()) continue;
+        size_t j = 0;
+        while (j < n.size() && toupper((unsigned char)n[j]) == toupper((unsigned char)s[j])) ++j;
+        if (j == n.size()) { k = (ItemKind)i; return true; }
+    }
+    return false;
+}
+
+string_view Item::getType() const { return itemType(kind()).name; }
+
+
+//Read-only view of a whole file, memory mapped where the platform allows it
+class MappedFile {
+    const char* base = nullptr;
+    size_t length = 0;
+    vector<char> fallback; //Used when mmap is unavailable
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    bool open(const string& file) {
+        close();
+#ifndef _WIN32
+        int fd = ::open(file.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0) { ::close(fd); return false; }
+        length = (size_t)st.st_size;
+        if (length > 0) {
+            void* p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) { ::close(fd); length = 0; return false; }
+            madvise(p, length, MADV_SEQUENTIAL);
+            base = (const char*)p;
+        }
+        ::close(fd); //The mapping stays valid after the descriptor is closed
+        return true;
+#else
+        ifstream ifs(file, ios::binary | ios::ate);
+        if (!ifs) return false;
+        fallback.resize((size_t)ifs.tellg());
+        ifs.seekg(0);
+        ifs.read(fallback.data(), fallback.size());
+        base = fallback.data(); length = fallback.size();
+        return true;
+#endif
+    }
+    void close() {
+#ifndef _WIN32
+        if (base && fallback.empty()) munmap((void*)base, length);
+#endif
+        fallback.clear();
+        base = nullptr; length = 0;
+    }
+    const char* data() const { return base; }
+    size_t size() const { return length; }
+};
+
+//Non-owning view of one item, strings point into a mapping or another item
+struct ItemView {
+    ItemKind kind = ItemKind::Grocery;
+    string_view type;
+    string_view name;
+    double price = 0.0;
+    string_view text; //Expiry, size or author
+    int number = 0;   //Warranty or recommended age
+
+    unique_ptr<Item> materialize() const { return itemType(kind).make(name, price, text, number); } //Builds the full object only when asked
+    Item* materialize(ItemArena& arena) const { return itemType(kind).makeIn(arena, name, price, text, number); } //Same, but the object and its strings live in arena
+};
+
+//Views an existing object through the same struct
+ItemView viewOf(const Item& i) {
+    ItemView v;
+    v.kind = i.kind();
+    v.type = i.getType();
+    v.name = i.getName();
+    v.price = i.getPrice();
+    itemType(v.kind).fields(i, v.text, v.number);
+    return v;
+}
+
+//Decodes the items.bin record at p, returns nullptr if it runs past end or is malformed.
+//texts is the file's string table, only used when interned.
+const char* decodeBinaryRecord(const char* p, const char* end, bool interned, const vector<string_view>& texts, ItemView& out) {
+    auto readString = [&](string_view& s) {
+        size_t len;
+        if ((size_t)(end - p) < sizeof(len)) return false;
+        memcpy(&len, p, sizeof(len)); p += sizeof(len);
+        if ((size_t)(end - p) < len) return false;
+        s = string_view(p, len); p += len;
+        return true;
+    };
+    auto readPod = [&](auto& v) {
+        if ((size_t)(end - p) < sizeof(v)) return false;
+        memcpy(&v, p, sizeof(v)); p += sizeof(v); //memcpy since fields are unaligned
+        return true;
+    };
+    if (interned) {
+        uint8_t tag;
+        if (!readPod(tag) || tag >= ITEM_KIND_COUNT) return nullptr;
+        out.kind = (ItemKind)tag;
+        out.type = itemType(out.kind).name;
+    } else if (!readString(out.type) || !kindFromName(out.type, out.kind)) {
+        return nullptr;
+    }
+    if (!readString(out.name) || !readPod(out.price)) return nullptr;
+    if (!kindHasText(out.kind)) {
+        if (!readPod(out.number)) return nullptr;
+        out.text = {};
+    } else if (interned) {
+        uint32_t idx;
+        if (!readPod(idx) || idx >= texts.size()) return nullptr;
+        out.text = texts[idx];
+        out.number = 0;
+    } else {
+        if (!readString(out.text)) return nullptr;
+        out.number = 0;
+    }
+    return p;
+}
+
+//Parses a string table written by BinaryStringTable::writeTable(), the views point into [p, end)
+bool parseStringTable(const char*& p, const char* end, vector<string_view>& out) {
+    uint32_t n, len;
+    if (end - p < 4) return false;
+    memcpy(&n, p, 4); p += 4;
+    out.reserve(min<size_t>(n, (end - p) / 4));
+    for (uint32_t i = 0; i < n; ++i) {
+        if (end - p < 4) return false;
+        memcpy(&len, p, 4); p += 4;
+        if ((size_t)(end - p) < len) return false;
+        out.emplace_back(p, len); p += len;
+    }
+    return true;
+}
+
+//Reader for compressed items.bin files:
+//  "IBLZ" | blocks | u32 count | count x (u64 offset | u32 packed size | u32 raw size | u32 records)
+//         | string table | u64 record count | u64 index offset | "IBLZ"
+//A block is a run of whole interned records compressed with lzCompress(), so each
+//one decodes on its own. Nothing is decompressed until a block is asked for.
+class CompressedCatalog {
+    struct Block {
+        uint64_t offset, firstRecord;
+        uint32_t packed, raw, records;
+    };
+    MappedFile file;
+    vector<Block> blocks;
+    vector<string_view> texts; //Into the mapping
+    uint64_t records = 0;
+public:
+    static constexpr char MAGIC[4] = { 'I', 'B', 'L', 'Z' };
+    static constexpr size_t INDEX_ENTRY = 20;
+    static constexpr uint32_t MAX_BLOCK = 64 << 20; //Larger raw sizes are taken as corrupt
+
+    static bool detect(const char* data, size_t size) { return size >= 4 && memcmp(data, MAGIC, 4) == 0; }
+    bool open(const string& path) { //Maps the file and reads the block index and string table
+        blocks.clear(); texts.clear(); records = 0;
+        if (!file.open(path)) return false;
+        const char* begin = file.data();
+        const size_t size = file.size(), FOOTER = BinaryStringTable::FOOTER;
+        if (size < 4 + 4 + 4 + FOOTER || !detect(begin, size) || memcmp(begin + size - 4, MAGIC, 4) != 0) return false;
+        uint64_t recordCount, indexOffset;
+        memcpy(&recordCount, begin + size - FOOTER, 8);
+        memcpy(&indexOffset, begin + size - FOOTER + 8, 8);
+        if (indexOffset < 4 || indexOffset > size - FOOTER - 8) return false;
+        const char* p = begin + indexOffset;
+        const char* end = begin + size - FOOTER;
+        uint32_t n;
+        memcpy(&n, p, 4); p += 4;
+        if ((size_t)(end - p) / INDEX_ENTRY < n) return false;
+        blocks.resize(n);
+        for (Block& b : blocks) {
+            memcpy(&b.offset, p, 8); memcpy(&b.packed, p + 8, 4); memcpy(&b.raw, p + 12, 4); memcpy(&b.records, p + 16, 4);
+            p += INDEX_ENTRY;
+            if (b.offset < 4 || b.offset > indexOffset || b.packed > indexOffset - b.offset || b.raw > MAX_BLOCK) return false;
+            b.firstRecord = records;
+            records += b.records;
+        }
+        return records == recordCount && parseStringTable(p, end, texts);
+    }
+    uint64_t size() const { return records; }
+    size_t fileSize() const { return file.size(); }
+    const vector<string_view>& strings() const { return texts; }
+    size_t blockCount() const { return blocks.size(); }
+    size_t rawSize(size_t b) const { return blocks[b].raw; }
+    uint32_t blockRecords(size_t b) const { return blocks[b].records; }
+    uint64_t firstRecord(size_t b) const { return blocks[b].firstRecord; }
+    size_t blockOf(uint64_t record) const { //Block holding the record, blockCount() when past the end
+        if (record >= records) return blocks.size();
+        auto it = upper_bound(blocks.begin(), blocks.end(), record, [](uint64_t r, const Block& b) { return r < b.firstRecord; });
+        return (size_t)(it - blocks.begin()) - 1;
+    }
+
+    //Decompresses block b into out, which must hold rawSize(b) bytes. Safe to call from several threads.
+    bool decompress(size_t b, char* out) const {
+        const Block& k = blocks[b];
+        return lzDecompress(file.data() + k.offset, k.packed, out, k.raw);
+    }
+    //Calls f(const ItemView&) for each record of block b, decompressed into scratch. False if the block is corrupt.
+    template <class F> bool forEachInBlock(size_t b, string& scratch, F f) const {
+        scratch.resize(blocks[b].raw);
+        if (!decompress(b, scratch.data())) return false;
+        const char* p = scratch.data();
+        const char* end = p + scratch.size();
+        ItemView v;
+        for (uint32_t i = 0; i < blocks[b].records; ++i) {
+            if (!(p = decodeBinaryRecord(p, end, true, texts, v))) return false;
+            f(v);
+        }
+        return p == end;
+    }
+    //Partial read of records [first, first + count), only the blocks holding them are decompressed
+    template <class F> bool read(uint64_t first, uint64_t count, F f) const {
+        if (first >= records) return true;
+        uint64_t last = count < records - first ? first + count : records;
+        string scratch;
+        for (size_t b = blockOf(first); b < blocks.size() && blocks[b].firstRecord < last; ++b) {
+            uint64_t r = blocks[b].firstRecord;
+            if (!forEachInBlock(b, scratch, [&](const ItemView& v) { if (r >= first && r < last) f(v); ++r; })) return false;
+        }
+        return true;
+    }
+};
+
+//Writes the format CompressedCatalog reads. Records go into buffer() with a commit()
+//after each one, a block is compressed and handed to the file once it is full.
+class CompressedBlockWriter {
+    AsyncFileWriter& w;
+    string raw, index;
+    uint32_t blocks = 0, inBlock = 0;
+
+    void flushBlock() {
+        if (inBlock == 0) return;
+        uint64_t offset = w.position();
+        string& out = w.buffer();
+        size_t at = out.size();
+        out.resize(at + lzCompressBound(raw.size()));
+        uint32_t packed = (uint32_t)lzCompress(raw.data(), raw.size(), &out[at]);
+        out.resize(at + packed);
+        w.commit();
+        uint32_t rawSize = (uint32_t)raw.size();
+        index.append((char*)&offset, 8);
+        index.append((char*)&packed, 4);
+        index.append((char*)&rawSize, 4);
+        index.append((char*)&inBlock, 4);
+        raw.clear();
+        inBlock = 0;
+        ++blocks;
+    }
+public:
+    static constexpr size_t BLOCK_BYTES = 256 << 10; //Raw bytes per block, enough for the codec to find repeats
+
+    explicit CompressedBlockWriter(AsyncFileWriter& writer) : w(writer) {
+        w.write(string_view(CompressedCatalog::MAGIC, 4));
+        raw.reserve(BLOCK_BYTES + 4096);
+    }
+    string& buffer() { return raw; }
+    void commit() {
+        ++inBlock;
+        if (raw.size() >= BLOCK_BYTES) flushBlock();
+    }
+    void finish(BinaryStringTable& strings, uint64_t recordCount) { //Last block, index, string table and footer
+        flushBlock();
+        uint64_t indexOffset = w.position();
+        w.write(string_view((char*)&blocks, sizeof(blocks)));
+        w.write(index);
+        strings.writeTable(w);
+        w.buffer().append((char*)&recordCount, sizeof(recordCount));
+        w.buffer().append((char*)&indexOffset, sizeof(indexOffset));
+        w.write(string_view(CompressedCatalog::MAGIC, 4));
+    }
+};
+
+//Zero-copy reader for items.bin: validates the file once, then hands out views.
+//A compressed file is decompressed up front, one block per task.
+class CatalogView {
+    MappedFile file;
+    vector<size_t> offsets; //Start of every valid record
+    bool truncated = false; //True when trailing bytes did not form a valid record
+    bool interned = false;  //Current format with a string table, otherwise the legacy one
+    vector<string_view> texts; //String table of an interned file
+    CompressedCatalog packed;  //Compressed files only, owns the mapping texts points into
+    string inflated;           //Their decompressed records
+    const char* base = nullptr; //Records and offsets are relative to this
+    size_t recordsEnd = 0;
+
+    const char* decode(const char* p, const char* end, ItemView& out) const { return decodeBinaryRecord(p, end, interned, texts, out); }
+    bool readTable(uint64_t tableOffset) { //String table of an interned file, as views into the mapping
+        const char* p = file.data() + tableOffset;
+        return parseStringTable(p, file.data() + file.size() - BinaryStringTable::FOOTER, texts);
+    }
+    bool inflate(const string& path) {
+        if (!packed.open(path)) return false;
+        interned = true;
+        texts = packed.strings();
+        size_t n = packed.blockCount();
+        vector<size_t> start(n + 1, 0);
+        for (size_t b = 0; b < n; ++b) start[b + 1] = start[b] + packed.rawSize(b);
+        inflated.resize(start[n]);
+        base = inflated.data();
+        recordsEnd = inflated.size();
+        vector<vector<size_t>> found(n); //Offsets of the records of each block
+        vector<char> ok(n, 0);
+        WorkerPool pool(n < 2 ? 1 : 0);
+        parallelFor(pool, n, [&](size_t, size_t first, size_t last) {
+            ItemView v;
+            for (size_t b = first; b < last; ++b) {
+                if (!packed.decompress(b, inflated.data() + start[b])) continue;
+                const char* p = base + start[b];
+                const char* end = base + start[b + 1];
+                found[b].reserve(packed.blockRecords(b));
+                while (p != end) {
+                    const char* next = decode(p, end, v);
+                    if (!next) break;
+                    found[b].push_back(p - base);
+                    p = next;
+                }
+                ok[b] = p == end && found[b].size() == packed.blockRecords(b);
+            }
+        });
+        offsets.reserve(packed.size());
+        for (size_t b = 0; b < n && !truncated; ++b) { //Keeps the records before the first bad block
+            offsets.insert(offsets.end(), found[b].begin(), found[b].end());
+            truncated = !ok[b];
+        }
+        return true;
+    }
+    bool index() { //Offsets of the records of a plain file
+        const char* begin = base = file.data();
+        size_t start = 0;
+        recordsEnd = file.size();
+        uint64_t records, tableOffset;
+        if (BinaryStringTable::locate(begin, file.size(), records, tableOffset)) {
+            interned = true;
+            if (!readTable(tableOffset)) return false;
+            start = 4;
+            recordsEnd = tableOffset;
+            offsets.reserve(records);
+        } else {
+            offsets.reserve(file.size() / 32); //Rough guess at the average record size
+        }
+        const char* end = begin + recordsEnd;
+        ItemView v;
+        for (const char* p = begin + start; p != end; ) {
+            const char* next = decode(p, end, v);
+            if (!next) { truncated = true; break; }
+            offsets.push_back(p - begin);
+            p = next;
+        }
+        return true;
+    }
+public:
+    bool open(const string& path) { //Maps the file and indexes every record
+        offsets.clear(); texts.clear(); inflated.clear(); truncated = false; interned = false;
+        if (!file.open(path)) return false;
+        bool compressed = CompressedCatalog::detect(file.data(), file.size());
+        if (compressed) {
+            file.close();
+            if (!inflate(path)) return false;
+        } else if (!index()) {
+            return false;
+        }
+        METRIC_COUNT("bytes_read", compressed ? packed.fileSize() : file.size());
+        METRIC_COUNT("records_parsed", offsets.size());
+        METRIC_COUNT("parse_errors", truncated ? 1 : 0);
+        return true;
+    }
+    size_t size() const { return offsets.size(); }
+    bool complete() const { return !truncated; }
+    ItemView operator[](size_t i) const {
+        ItemView v;
+        decode(base + offsets[i], base + recordsEnd, v);
+        return v;
+    }
+};
+
+//Sequential items.bin reader for files too large to map and index: only the string
+//table and a window of the records are held in memory. A compressed file is read
+//one block at a time. Table strings stay local to the stream, nothing goes into
+//the global StringPool.
+class BinaryRecordStream {
+    static constexpr size_t MAX_RECORD = 16 << 20; //Anything longer is taken as corrupt
+    ifstream ifs;
+    string tableData; //String table of a plain interned file
+    CompressedCatalog packed;
+    vector<string_view> texts; //Into tableData or the compressed file's mapping
+    size_t heldTable = 0;
+    bool interned = false, compressed = false, truncated = false;
+    uint64_t remaining = 0; //Record bytes not read from the file yet
+    size_t nextBlock = 0;   //Of a compressed file
+    string buf;
+    size_t pos = 0, window = 0;
+
+    bool refill() { //Keeps the unread tail and appends up to window more bytes, or the next block
+        if (compressed) {
+            if (nextBlock == packed.blockCount()) return false;
+            buf.erase(0, pos);
+            pos = 0;
+            size_t old = buf.size();
+            buf.resize(old + packed.rawSize(nextBlock));
+            if (!packed.decompress(nextBlock++, &buf[old])) {
+                buf.resize(old);
+                nextBlock = packed.blockCount();
+                truncated = true;
+                return false;
+            }
+            return true;
+        }
+        if (remaining == 0) return false;
+        buf.erase(0, pos);
+        pos = 0;
+        size_t n = (size_t)min<uint64_t>(remaining, window);
+        size_t old = buf.size();
+        buf.resize(old + n);
+        ifs.read(&buf[old], n);
+        buf.resize(old + (size_t)ifs.gcount());
+        remaining = ifs.gcount() == (streamsize)n ? remaining - n : 0;
+        METRIC_COUNT("bytes_read", ifs.gcount());
+        return buf.size() > old;
+    }
+    bool readTable() { //Table of a plain interned file and the record bytes before it, false for a legacy file
+        const size_t FOOTER = BinaryStringTable::FOOTER;
+        char head[4], tail[FOOTER];
+        ifs.clear();
+        ifs.seekg(0, ios::end);
+        uint64_t size = (uint64_t)ifs.tellg(), tableOffset;
+        if (!ifs || size < 4 + 4 + FOOTER) return false;
+        ifs.seekg(0); ifs.read(head, 4);
+        ifs.seekg(size - FOOTER); ifs.read(tail, FOOTER);
+        if (!ifs || memcmp(head, BinaryStringTable::MAGIC, 4) != 0 || memcmp(tail + 16, BinaryStringTable::MAGIC, 4) != 0) return false;
+        memcpy(&tableOffset, tail + 8, 8);
+        if (tableOffset < 4 || tableOffset > size - FOOTER - 4) return false;
+        tableData.resize(size - FOOTER - tableOffset);
+        ifs.seekg(tableOffset); ifs.read(&tableData[0], tableData.size());
+        const char* p = tableData.data();
+        if (!ifs || !parseStringTable(p, p + tableData.size(), texts)) { texts.clear(); return false; }
+        remaining = tableOffset - 4;
+        ifs.seekg(4);
+        return true;
+    }
+public:
+    bool open(const string& path, size_t windowBytes = 1 << 20) {
+        ifs.close(); ifs.clear();
+        buf.clear(); texts.clear(); tableData.clear();
+        pos = 0; window = max<size_t>(windowBytes, 4096);
+        truncated = compressed = false;
+        ifs.open(path, ios::binary);
+        if (!ifs) return false;
+        char head[4] = {};
+        ifs.read(head, 4);
+        if (CompressedCatalog::detect(head, (size_t)ifs.gcount())) {
+            ifs.close();
+            compressed = interned = true;
+            nextBlock = 0;
+            remaining = 0;
+            if (!packed.open(path)) return false;
+            texts = packed.strings();
+            heldTable = texts.size() * sizeof(string_view);
+            for (string_view t : texts) heldTable += t.size(); //Mapped, but resident once read
+            return true;
+        }
+        interned = readTable();
+        if (!interned) {
+            tableData.clear();
+            ifs.clear();
+            ifs.seekg(0, ios::end);
+            remaining = (uint64_t)ifs.tellg();
+            ifs.seekg(0);
+        }
+        heldTable = tableData.size() + texts.size() * sizeof(string_view);
+        return (bool)ifs;
+    }
+    size_t tableBytes() const { return heldTable; } //Memory the string table takes up
+    //Views in v stay valid until the next call
+    bool next(ItemView& v) {
+        while (true) {
+            const char* p = buf.data() + pos;
+            const char* end = decodeBinaryRecord(p, buf.data() + buf.size(), interned, texts, v);
+            if (end) { pos += end - p; return true; }
+            if (buf.size() - pos > MAX_RECORD || !refill()) {
+                truncated = truncated || pos != buf.size() || remaining != 0;
+                return false;
+            }
+        }
+    }
+    bool complete() const { return !truncated; }
+};
+
+//String table for writers that must stay off the global StringPool, such as the
+//external sort. It keeps its own copies of the strings and reports roughly what
+//they take up, so they can be counted against a memory budget.
+class LocalStringTable {
+    pmr::monotonic_buffer_resource chars;
+    unordered_map<string_view, uint32_t> ids;
+    vector<string_view> strings;
+    size_t held = 0;
+public:
+    uint32_t add(string_view s) { //Index of s in the table, adding a copy on first use
+        auto it = ids.find(s);
+        if (it != ids.end()) return it->second;
+        char* p = (char*)chars.allocate(max<size_t>(s.size(), 1), 1);
+        if (!s.empty()) memcpy(p, s.data(), s.size());
+        uint32_t id = (uint32_t)strings.size();
+        strings.emplace_back(p, s.size());
+        ids.emplace(strings.back(), id);
+        held += s.size() + 64; //Bytes plus about what the hash node and the view cost
+        return id;
+    }
+    size_t bytes() const { return held; }
+    const vector<string_view>& views() const { return strings; }
+};
+
+//Writes v as one items.bin record, the same bytes Item::persistBinary produces
+void appendBinaryRecord(string& out, const ItemView& v, LocalStringTable& strings) {
+    out.push_back((char)(uint8_t)v.kind);
+    size_t len = v.name.size();
+    out.append((const char*)&len, sizeof(len)); out.append(v.name.data(), len);
+    out.append((const char*)&v.price, sizeof(v.price));
+    if (kindHasText(v.kind)) {
+        uint32_t idx = strings.add(v.text);
+        out.append((const char*)&idx, sizeof(idx));
+    } else {
+        int32_t n = v.number;
+        out.append((const char*)&n, sizeof(n));
+    }
+}
+
+
+//Parses one "TYPE|name|price|field" line of the items.txt format, error (if given)
+//says what was wrong when it returns false
+bool parseTextRecord(string_view line, ItemView& out, string* error = nullptr) {
+    auto fail = [&](const char* what, string_view field) {
+        if (error) { *error = what; if (!field.empty()) *error += " '" + string(field) + "'"; }
+        return false;
+    };
+    string_view f[4];
+    for (int i = 0; i < 4; ++i) {
+        size_t bar = i < 3 ? line.find('|') : line.size();
+        if (bar == string_view::npos) return fail("expected TYPE|name|price|field", {});
+        f[i] = line.substr(0, bar);
+        line.remove_prefix(i < 3 ? bar + 1 : bar);
+    }
+    ItemKind k;
+    if (!kindFromName(f[0], k)) return fail("unknown type", f[0]);
+    out.kind = k;
+    out.type = itemType(k).name;
+    out.name = f[1];
+    auto pr = from_chars(f[2].data(), f[2].data() + f[2].size(), out.price);
+    if (pr.ec != errc() || pr.ptr != f[2].data() + f[2].size() || !std::isfinite(out.price)) return fail("bad price", f[2]); //from_chars takes "nan" and "inf" too
+    if (kindHasText(k)) { out.text = f[3]; out.number = 0; return true; }
+    out.text = {};
+    auto nr = from_chars(f[3].data(), f[3].data() + f[3].size(), out.number);
+    if (nr.ec != errc() || nr.ptr != f[3].data() + f[3].size()) return fail("bad number", f[3]);
+    return true;
+}
+
+//Columnar catalog format (items.cat), all numbers stored little-endian:
+//  header  : magic "SCAT", u16 version, u8 endianness (1 = little), u8 reserved, u64 item count,
+//            then from version 2 a u64 journal sequence the snapshot covers
+//  tags    : one ItemKind byte per item, in catalog order
+//  strings : u32 count, then u32 length + bytes for every distinct name/expiry/size/author
+//  columns : for each kind, u64 count, f64 price[], u32 name[], then u32 string[] or i32 number[]
+const char CATALOG_MAGIC[4] = { 'S', 'C', 'A', 'T' };
+const uint16_t CATALOG_VERSION = 2; //Version 1 files (no journal sequence) are still read
+const uint8_t CATALOG_LITTLE_ENDIAN = 1;
+
+class ColumnarWriter {
+    struct Column { vector<double> price; vector<uint32_t> name, extra; };
+    vector<uint8_t> tags;
+    vector<string_view> strings;
+    unordered_map<string_view, uint32_t> stringIds;
+    Column columns[ITEM_KIND_COUNT];
+
+    uint32_t intern(string_view s) { //Each distinct string is stored once
+        auto it = stringIds.find(s);
+        if (it != stringIds.end()) return it->second;
+        uint32_t id = (uint32_t)strings.size();
+        strings.push_back(s);
+        stringIds.emplace(s, id);
+        return id;
+    }
+public:
+    //Strings are referenced, not copied, so they must stay alive until write()
+    void add(ItemKind k, string_view name, double price, string_view text, int number) {
+        Column& c = columns[(int)k];
+        tags.push_back((uint8_t)k);
+        c.price.push_back(price);
+        c.name.push_back(intern(name));
+        c.extra.push_back(kindHasText(k) ? intern(text) : (uint32_t)number);
+    }
+    void add(const ItemView& v) { add(v.kind, v.name, v.price, v.text, v.number); }
+    void add(const Item& i) { add(viewOf(i)); }
+
+    //Encodes the catalog into buf, handing it to os in 1 MiB pieces when os is given
+    void serialize(string& buf, ostream* os, uint64_t journalSeq = 0) const {
+        auto flush = [&](size_t threshold) { if (os && buf.size() >= threshold) { os->write(buf.data(), buf.size()); buf.clear(); } };
+        auto put = [&](uint64_t v, int bytes) { for (int b = 0; b < bytes; ++b) buf.push_back((char)(v >> (8 * b))); flush(1 << 20); };
+        auto putDouble = [&](double d) { uint64_t bits; memcpy(&bits, &d, sizeof(bits)); put(bits, 8); };
+
+        buf.append(CATALOG_MAGIC, sizeof(CATALOG_MAGIC));
+        put(CATALOG_VERSION, 2); put(CATALOG_LITTLE_ENDIAN, 1); put(0, 1);
+        put(tags.size(), 8);
+        put(journalSeq, 8);
+        buf.append((const char*)tags.data(), tags.size());
+        put(strings.size(), 4);
+        for (auto sv : strings) { put(sv.size(), 4); buf.append(sv.data(), sv.size()); flush(1 << 20); }
+        for (const Column& c : columns) {
+            put(c.price.size(), 8);
+            for (double d : c.price) putDouble(d);
+            for (uint32_t n : c.name) put(n, 4);
+            for (uint32_t e : c.extra) put(e, 4);
+        }
+        flush(0);
+    }
+    bool write(const string& file, uint64_t journalSeq = 0) const {
+        ofstream ofs(file, ios::binary);
+        if (!ofs) return false;
+        string buf;
+        serialize(buf, &ofs, journalSeq);
+        return (bool)ofs;
+    }
+};
+
+//Reader for items.cat, validates the layout once and walks the columns in catalog order
+class ColumnarCatalog {
+    struct Column { uint64_t count = 0; const char* price = nullptr; const char* name = nullptr; const char* extra = nullptr; };
+    MappedFile file;
+    uint64_t count = 0;
+    uint64_t journalSeq = 0;
+    const uint8_t* tags = nullptr;
+    vector<string_view> strings;
+    Column columns[ITEM_KIND_COUNT];
+
+    static uint64_t get(const char* p, int bytes) {
+        uint64_t v = 0;
+        for (int b = 0; b < bytes; ++b) v |= (uint64_t)(uint8_t)p[b] << (8 * b);
+        return v;
+    }
+public:
+    bool open(const string& path) {
+        strings.clear();
+        if (!file.open(path)) return false;
+        METRIC_COUNT("bytes_read", file.size());
+        const char* p = file.data();
+        const char* end = p + file.size();
+        auto need = [&](uint64_t n) { return (uint64_t)(end - p) >= n; };
+        if (!need(16) || memcmp(p, CATALOG_MAGIC, 4) != 0) return false;
+        uint64_t version = get(p + 4, 2);
+        if (version < 1 || version > CATALOG_VERSION || (uint8_t)p[6] != CATALOG_LITTLE_ENDIAN) return false;
+        count = get(p + 8, 8); p += 16;
+        journalSeq = 0;
+        if (version >= 2) {
+            if (!need(8)) return false;
+            journalSeq = get(p, 8); p += 8;
+        }
+        if (!need(count)) return false;
+        tags = (const uint8_t*)p; p += count;
+        if (!need(4)) return false;
+        uint64_t nStrings = get(p, 4); p += 4;
+        strings.reserve(nStrings);
+        for (uint64_t i = 0; i < nStrings; ++i) {
+            if (!need(4)) return false;
+            uint64_t len = get(p, 4); p += 4;
+            if (!need(len)) return false;
+            strings.emplace_back(p, len); p += len;
+        }
+        uint64_t perKind[ITEM_KIND_COUNT] = {};
+        for (uint64_t i = 0; i < count; ++i) {
+            if (tags[i] >= ITEM_KIND_COUNT) return false;
+            ++perKind[tags[i]];
+        }
+        for (int k = 0; k < ITEM_KIND_COUNT; ++k) {
+            Column& c = columns[k];
+            if (!need(8)) return false;
+            c.count = get(p, 8); p += 8;
+            if (c.count != perKind[k] || !need(c.count * 16)) return false;
+            c.price = p; c.name = p + c.count * 8; c.extra = p + c.count * 12;
+            p += c.count * 16;
+            for (uint64_t i = 0; i < c.count; ++i) {
+                if (get(c.name + i * 4, 4) >= nStrings) return false;
+                if (kindHasText((ItemKind)k) && get(c.extra + i * 4, 4) >= nStrings) return false;
+            }
+        }
+        return p == end;
+    }
+    size_t size() const { return count; }
+    uint64_t sequence() const { return journalSeq; } //Last journal record included in this snapshot
+
+    template <class F> void forEach(F f) const { //Calls f(const ItemView&) for every item in catalog order
+        uint64_t cursor[ITEM_KIND_COUNT] = {};
+        ItemView v;
+        for (uint64_t i = 0; i < count; ++i) {
+            int k = tags[i];
+            const Column& c = columns[k];
+            uint64_t row = cursor[k]++;
+            uint64_t bits = get(c.price + row * 8, 8);
+            memcpy(&v.price, &bits, sizeof(bits));
+            v.kind = (ItemKind)k;
+            v.type = itemType((ItemKind)k).name;
+            v.name = strings[get(c.name + row * 4, 4)];
+            uint32_t extra = (uint32_t)get(c.extra + row * 4, 4);
+            if (kindHasText((ItemKind)k)) { v.text = strings[extra]; v.number = 0; }
+            else { v.text = {}; v.number = (int32_t)extra; }
+            f(v);
+        }
+    }
+};
+
+//Converters from the old formats, no Item objects are built on the way
+bool convertLegacyBinary(const string& in, const string& out) {
+    CatalogView view;
+    if (!view.open(in)) return false;
+    ColumnarWriter w;
+    for (size_t i = 0; i < view.size(); ++i) w.add(view[i]);
+    if (!view.complete()) cerr << in << ": trailing bytes after record " << view.size() << " ignored\n";
+    return w.write(out);
+}
+
+bool convertText(const string& in, const string& out) {
+    MappedFile file;
+    if (!file.open(in)) return false;
+    string_view rest(file.data(), file.size());
+    ColumnarWriter w;
+    size_t lineNo = 0;
+    while (!rest.empty()) {
+        size_t nl = rest.find('\n');
+        string_view line = rest.substr(0, nl);
+        rest.remove_prefix(nl == string_view::npos ? rest.size() : nl + 1);
+        ++lineNo;
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        if (line.empty() || line[0] == '#') continue; //Comments such as the journal "#SEQ|n" header
+        ItemView v;
+        if (parseTextRecord(line, v)) { w.add(v); METRIC_COUNT("records_parsed", 1); }
+        else { cerr << in << ":" << lineNo << ": malformed record skipped\n"; METRIC_COUNT("parse_errors", 1); }
+    }
+    return w.write(out);
+}
+
+
+//Struct-of-arrays alternative to Container. Each kind keeps its own field in a
+//contiguous array and prices sit in one dense array, so bulk operations run as
+//plain loops without pointer chasing or virtual calls.
+class ItemStore {
+    vector<double> prices;   //One entry per item, in insertion order
+    vector<ItemKind> kinds;
+    vector<uint32_t> rows;   //Row of the item inside its kind's field array
+    vector<string> names;
+    vector<InternedString> groceryExpiry; //Repeated values share one pooled copy
+    vector<Date> groceryExpiryDate;
+    vector<int> electronicsWarranty;
+    vector<InternedString> clothingSize;
+    vector<InternedString> bookAuthor;
+    vector<int> toyRecommendedAge;
+public:
+    void reserve(size_t n) { prices.reserve(n); kinds.reserve(n); rows.reserve(n); names.reserve(n); }
+    size_t size() const { return prices.size(); }
+
+    size_t add(ItemKind k, string_view name, double price, string_view text, int number) {
+        uint32_t row = 0;
+        switch (k) {
+            case ItemKind::Grocery:
+                row = (uint32_t)groceryExpiry.size();
+                groceryExpiry.emplace_back(text);
+                groceryExpiryDate.push_back(Date::parse(text));
+                break;
+            case ItemKind::Electronics: row = (uint32_t)electronicsWarranty.size(); electronicsWarranty.push_back(number); break;
+            case ItemKind::Clothing: row = (uint32_t)clothingSize.size(); clothingSize.emplace_back(text); break;
+            case ItemKind::Book: row = (uint32_t)bookAuthor.size(); bookAuthor.emplace_back(text); break;
+            case ItemKind::Toy: row = (uint32_t)toyRecommendedAge.size(); toyRecommendedAge.push_back(number); break;
+        }
+        prices.push_back(price);
+        kinds.push_back(k);
+        rows.push_back(row);
+        names.emplace_back(name);
+        return prices.size() - 1;
+    }
+    size_t add(const ItemView& v) { return add(v.kind, v.name, v.price, v.text, v.number); }
+    size_t add(const Item& i) { return add(viewOf(i)); }
+
+    bool loadColumnar(const string& file) { //Fills the store straight from items.cat
+        ColumnarCatalog cat;
+        if (!cat.open(file)) return false;
+        reserve(size() + cat.size());
+        cat.forEach([&](const ItemView& v) { add(v); });
+        return true;
+    }
+
+    //Per item access
+    double price(size_t i) const { return prices[i]; }
+    ItemKind kind(size_t i) const { return kinds[i]; }
+    const string& name(size_t i) const { return names[i]; }
+    ItemView view(size_t i) const {
+        ItemView v;
+        v.kind = kinds[i];
+        v.type = itemType(v.kind).name;
+        v.name = names[i];
+        v.price = prices[i];
+        uint32_t r = rows[i];
+        switch (v.kind) {
+            case ItemKind::Grocery: v.text = groceryExpiry[r].view(); break;
+            case ItemKind::Electronics: v.number = electronicsWarranty[r]; break;
+            case ItemKind::Clothing: v.text = clothingSize[r].view(); break;
+            case ItemKind::Book: v.text = bookAuthor[r].view(); break;
+            case ItemKind::Toy: v.number = toyRecommendedAge[r]; break;
+        }
+        return v;
+    }
+    unique_ptr<Item> materialize(size_t i) const { return view(i).materialize(); } //Item adapter for existing callers
+
+    //Bulk operations over the dense arrays
+    double totalValue() const {
+        double total = 0.0;
+        for (double p : prices) total += p;
+        return total;
+    }
+    vector<size_t> filterByPrice(double minPrice, double maxPrice) const { //Indices of items priced in [min, max]
+        vector<size_t> out;
+        for (size_t i = 0; i < prices.size(); ++i)
+            if (prices[i] >= minPrice && prices[i] <= maxPrice) out.push_back(i);
+        return out;
+    }
+    array<size_t, ITEM_KIND_COUNT> countByType() const {
+        array<size_t, ITEM_KIND_COUNT> counts{};
+        for (ItemKind k : kinds) ++counts[(int)k];
+        return counts;
+    }
+    const vector<double>& priceColumn() const { return prices; }
+    const vector<InternedString>& expiryColumn() const { return groceryExpiry; }
+    const vector<Date>& expiryDateColumn() const { return groceryExpiryDate; }
+    const vector<int>& warrantyColumn() const { return electronicsWarranty; }
+    const vector<InternedString>& sizeColumn() const { return clothingSize; }
+    const vector<InternedString>& authorColumn() const { return bookAuthor; }
+    const vector<int>& recommendedAgeColumn() const { return toyRecommendedAge; }
+};
+
+
+//Order-statistics treap over item prices, kept up to date by Container.
+//Keys are ordered by descending price (ties by address) so an in-order walk
+//streams the most expensive items first. NaN prices are ordered after every
+//other price, which keeps the order total. Nodes live in one vector and refer
+//to each other by index.
+class PriceIndex {
+    static const uint32_t NIL = 0xFFFFFFFFu;
+    struct Node { double price; const Item* item; uint32_t prio, size, left, right; };
+    vector<Node> nodes;
+    vector<uint32_t> freeSlots;
+    uint32_t root = NIL;
+    uint32_t seed = 2463534242u;
+
+    static bool before(double p1, const Item* i1, double p2, const Item* i2) {
+        bool n1 = std::isnan(p1), n2 = std::isnan(p2);
+        if (n1 != n2) return n2;
+        return !n1 && p1 != p2 ? p1 > p2 : less<const Item*>()(i1, i2);
+    }
+    uint32_t nextPrio() { seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5; return seed; } //xorshift32
+    uint32_t sz(uint32_t n) const { return n == NIL ? 0 : nodes[n].size; }
+    void pull(uint32_t n) { nodes[n].size = 1 + sz(nodes[n].left) + sz(nodes[n].right); }
+
+    uint32_t newNode(double p, const Item* it, uint32_t prio) {
+        Node n{ p, it, prio, 1, NIL, NIL };
+        if (!freeSlots.empty()) { uint32_t id = freeSlots.back(); freeSlots.pop_back(); nodes[id] = n; return id; }
+        nodes.push_back(n);
+        return (uint32_t)nodes.size() - 1;
+    }
+    //Splits t into the keys ordered before (p, it) and the rest
+    void split(uint32_t t, double p, const Item* it, uint32_t& l, uint32_t& r) {
+        if (t == NIL) { l = r = NIL; return; }
+        if (before(nodes[t].price, nodes[t].item, p, it)) { split(nodes[t].right, p, it, nodes[t].right, r); l = t; }
+        else { split(nodes[t].left, p, it, l, nodes[t].left); r = t; }
+        pull(t);
+    }
+    uint32_t merge(uint32_t a, uint32_t b) { //Every key of a is ordered before every key of b
+        if (a == NIL) return b;
+        if (b == NIL) return a;
+        if (nodes[a].prio > nodes[b].prio) { nodes[a].right = merge(nodes[a].right, b); pull(a); return a; }
+        nodes[b].left = merge(a, nodes[b].left); pull(b); return b;
+    }
+    bool erase(uint32_t& t, double p, const Item* it) {
+        if (t == NIL) return false;
+        if (nodes[t].item == it) { //By identity, the price only finds the path
+            uint32_t dead = t;
+            t = merge(nodes[t].left, nodes[t].right);
+            freeSlots.push_back(dead);
+            return true;
+        }
+        bool found = before(p, it, nodes[t].price, nodes[t].item) ? erase(nodes[t].left, p, it) : erase(nodes[t].right, p, it);
+        if (found) pull(t);
+        return found;
+    }
+    uint32_t build(uint32_t lo, uint32_t hi, uint32_t depth) { //Balanced tree over already sorted nodes[lo, hi)
+        if (lo >= hi) return NIL;
+        uint32_t mid = lo + (hi - lo) / 2;
+        nodes[mid].prio = 0xFFFFFFFFu - depth; //Shallower nodes keep the higher priority
+        nodes[mid].left = build(lo, mid, depth + 1);
+        nodes[mid].right = build(mid + 1, hi, depth + 1);
+        pull(mid);
+        return mid;
+    }
+public:
+    size_t size() const { return sz(root); }
+    void clear() { nodes.clear(); freeSlots.clear(); root = NIL; }
+    void insert(const Item* it) {
+        uint32_t n = newNode(it->getPrice(), it, nextPrio()), l, r;
+        split(root, it->getPrice(), it, l, r);
+        root = merge(merge(l, n), r);
+    }
+    bool erase(const Item* it) { return erase(root, it->getPrice(), it); }
+    template <class Ptr> void rebuild(const vector<Ptr>& items) { //O(n log n) bulk load instead of n inserts
+        clear();
+        nodes.reserve(items.size());
+        for (const auto& i : items) nodes.push_back(Node{ i->getPrice(), &*i, 0, 1, NIL, NIL });
+        sort(nodes.begin(), nodes.end(), [](const Node& a, const Node& b) { return before(a.price, a.item, b.price, b.item); });
+        root = build(0, (uint32_t)nodes.size(), 0);
+    }
+
+    //In-order walk on from the path on stack, calling f(const Item&) until limit items
+    //went or one fails keep(price)
+    template <class Keep, class F> void walk(vector<uint32_t>& stack, size_t limit, Keep keep, F f) const {
+        while (!stack.empty() && limit > 0) {
+            uint32_t t = stack.back(); stack.pop_back();
+            if (!keep(nodes[t].price)) break;
+            f(*nodes[t].item);
+            --limit;
+            for (t = nodes[t].right; t != NIL; t = nodes[t].left) stack.push_back(t);
+        }
+    }
+
+    //Calls f(const Item&) for items in descending price order, starting with the first
+    //one priced at or below maxPrice and stopping below minPrice or after limit items.
+    //NaN prices are in no range.
+    template <class F> void forEach(double maxPrice, double minPrice, size_t limit, F f) const {
+        vector<uint32_t> stack;
+        for (uint32_t t = root; t != NIL; ) {
+            if (!(nodes[t].price > maxPrice)) { stack.push_back(t); t = nodes[t].left; } //NaN sorts last, so it is past the start too
+            else t = nodes[t].right;
+        }
+        walk(stack, limit, [&](double p) { return p >= minPrice; }, f);
+    }
+    template <class F> void topK(size_t k, F f) const { //Every item counts here, NaN prices last
+        vector<uint32_t> stack;
+        for (uint32_t t = root; t != NIL; t = nodes[t].left) stack.push_back(t);
+        walk(stack, k, [](double) { return true; }, f);
+    }
+    template <class F> void inRange(double minPrice, double maxPrice, F f) const { forEach(maxPrice, minPrice, SIZE_MAX, f); }
+    size_t rank(double price) const { //Number of items ordered before price: strictly more expensive, or every priced item for NaN
+        size_t r = 0;
+        for (uint32_t t = root; t != NIL; ) {
+            if (before(nodes[t].price, nodes[t].item, price, nullptr)) { r += sz(nodes[t].left) + 1; t = nodes[t].right; }
+            else t = nodes[t].left;
+        }
+        return r;
+    }
+    const Item* at(size_t r) const { //r-th most expensive item, 0-based
+        for (uint32_t t = root; t != NIL; ) {
+            size_t l = sz(nodes[t].left);
+            if (r < l) t = nodes[t].left;
+            else if (r == l) return nodes[t].item;
+            else { r -= l + 1; t = nodes[t].right; }
+        }
+        return nullptr;
+    }
+};
+
+
+//Journal payloads for Container changes:
+//  'A' item | 'U' u64 index item | 'R' u64 index (read from older logs only) | 'S' u64 index
+//'S' (swap-remove) moves the last item into the place of the removed one, 'R' shifts the rest down.
+//item is u8 kind, u32 name length, name, f64 price, then u32 length and text or i32 number
+void encodeItem(string& out, const ItemView& v) {
+    auto put = [&](uint64_t x, int bytes) { for (int b = 0; b < bytes; ++b) out.push_back((char)(x >> (8 * b))); };
+    uint64_t bits;
+    memcpy(&bits, &v.price, sizeof(bits));
+    put((uint8_t)v.kind, 1);
+    put(v.name.size(), 4); out.append(v.name.data(), v.name.size());
+    put(bits, 8);
+    if (kindHasText(v.kind)) { put(v.text.size(), 4); out.append(v.text.data(), v.text.size()); }
+    else put((uint32_t)v.number, 4);
+}
+bool decodeItem(string_view& in, ItemView& v) {
+    auto get = [&](uint64_t& x, size_t bytes) {
+        if (in.size() < bytes) return false;
+        x = 0;
+        for (size_t b = 0; b < bytes; ++b) x |= (uint64_t)(uint8_t)in[b] << (8 * b);
+        in.remove_prefix(bytes);
+        return true;
+    };
+    auto getString = [&](string_view& s) {
+        uint64_t len;
+        if (!get(len, 4) || in.size() < len) return false;
+        s = in.substr(0, len);
+        in.remove_prefix(len);
+        return true;
+    };
+    uint64_t k, bits, n;
+    if (!get(k, 1) || k >= ITEM_KIND_COUNT || !getString(v.name) || !get(bits, 8)) return false;
+    v.kind = (ItemKind)k;
+    v.type = itemType((ItemKind)k).name;
+    memcpy(&v.price, &bits, sizeof(bits));
+    if (kindHasText(v.kind)) { v.number = 0; return getString(v.text); }
+    v.text = {};
+    if (!get(n, 4)) return false;
+    v.number = (int32_t)(uint32_t)n;
+    return true;
+}
+
+//Out-of-core sort of items.bin for catalogs larger than memory. sortRuns() streams
+//the input into runs that fill the memory budget, sorts each run on a thread pool
+//and spills it to a temporary file of u32-length-prefixed journal-encoded items.
+//forEachSorted() then merges the runs k ways at a time, in several passes when more
+//runs exist than read windows fit in the budget. Equal keys keep their file order.
+enum class SortKey { PriceDescending, PriceAscending, Name };
+
+struct ExternalSortOptions {
+    size_t memoryBudget = 256 << 20;         //Bytes for run data, sort entries, read windows and write buffers
+    SortKey key = SortKey::PriceDescending;  //Option 6 order
+    unsigned threads = 0;                    //Sort threads, 0 for one per core
+    string tempDir = ".";                    //Where runs are spilled
+};
+
+class ExternalSort {
+    static constexpr size_t MIN_WINDOW = 256 << 10;
+    struct Entry { //One record of the run being built
+        double price;
+        uint64_t offset;
+        uint32_t length, nameLength;
+    };
+    //Reads one spilled run through a fixed window
+    class RunReader {
+        ifstream ifs;
+        string buf;
+        size_t pos = 0, window = MIN_WINDOW;
+        bool corrupt = false;
+    public:
+        bool open(const string& file, size_t windowBytes) {
+            window = windowBytes;
+            ifs.open(file, ios::binary);
+            return (bool)ifs;
+        }
+        bool next(ItemView& v) { //Views in v stay valid until the next call
+            while (true) {
+                uint32_t len;
+                if (buf.size() - pos >= 4 && (memcpy(&len, buf.data() + pos, 4), buf.size() - pos - 4 >= len)) {
+                    string_view rec(buf.data() + pos + 4, len);
+                    pos += 4 + (size_t)len;
+                    if (decodeItem(rec, v)) return true;
+                    corrupt = true;
+                    return false;
+                }
+                buf.erase(0, pos);
+                pos = 0;
+                size_t old = buf.size();
+                buf.resize(old + window);
+                ifs.read(&buf[old], window);
+                buf.resize(old + (size_t)ifs.gcount());
+                if (buf.size() == old) { corrupt = old != 0; return false; }
+            }
+        }
+        bool complete() const { return !corrupt; }
+    };
+
+    ExternalSortOptions opt;
+    vector<string> runs;
+    uint64_t records = 0;
+    unsigned runsMade = 0;
+    size_t tableBytes = 0; //Input string table, and the output one that sortFile() builds up to the same size
+
+    size_t budget() const { return opt.memoryBudget - min(opt.memoryBudget, tableBytes); } //What is left for records and buffers
+
+    bool before(double pa, string_view na, double pb, string_view nb) const {
+        if (opt.key == SortKey::Name) return na < nb;
+        if (std::isnan(pa) || std::isnan(pb)) return !std::isnan(pa) && std::isnan(pb); //NaN prices go last
+        return opt.key == SortKey::PriceAscending ? pa < pb : pa > pb;
+    }
+    bool before(const ItemView& a, const ItemView& b) const { return before(a.price, a.name, b.price, b.name); }
+    size_t writeBuffer() const { return min<size_t>(4 << 20, max<size_t>(64 << 10, budget() / 16)); }
+    size_t fanIn() const { return max<size_t>(2, budget() / MIN_WINDOW / 2); }
+    string newRunName() {
+        return opt.tempDir + "/items-sort-" + to_string(getpid()) + "-" + to_string((uintptr_t)this) + "-" + to_string(runsMade++) + ".run";
+    }
+    static void putRecord(AsyncFileWriter& w, string_view rec) {
+        uint32_t len = (uint32_t)rec.size();
+        w.buffer().append((const char*)&len, 4);
+        w.buffer().append(rec.data(), rec.size());
+        w.commit();
+    }
+
+    bool spill(WorkerPool& pool, string& data, vector<Entry>& entries) {
+        auto name = [&](const Entry& e) { return string_view(data.data() + e.offset + 5, e.nameLength); }; //After u8 kind and u32 length
+        auto less = [&](const Entry& a, const Entry& b) { return before(a.price, name(a), b.price, name(b)); };
+        //Sorted slices in parallel, then merged pairwise in parallel rounds
+        size_t slices = max<size_t>(1, min<size_t>(pool.size(), entries.size() / 4096));
+        vector<size_t> bounds(slices + 1);
+        for (size_t s = 0; s <= slices; ++s) bounds[s] = entries.size() * s / slices;
+        parallelFor(pool, slices, [&](size_t, size_t first, size_t last) {
+            for (size_t s = first; s < last; ++s) stable_sort(entries.begin() + bounds[s], entries.begin() + bounds[s + 1], less);
+        });
+        for (size_t width = 1; width < slices; width *= 2) {
+            parallelFor(pool, (slices + 2 * width - 1) / (2 * width), [&](size_t, size_t first, size_t last) {
+                for (size_t p = first; p < last; ++p) {
+                    size_t lo = p * 2 * width, mid = min(lo + width, slices), hi = min(lo + 2 * width, slices);
+                    inplace_merge(entries.begin() + bounds[lo], entries.begin() + bounds[mid], entries.begin() + bounds[hi], less);
+                }
+            });
+        }
+        AsyncFileWriter w(writeBuffer());
+        string file = newRunName();
+        if (!w.open(file)) return false;
+        runs.push_back(file);
+        for (const Entry& e : entries) putRecord(w, string_view(data.data() + e.offset, e.length));
+        data.clear();
+        entries.clear();
+        METRIC_COUNT("sort_runs_spilled", 1);
+        return w.close();
+    }
+    //Merges files and calls f(const ItemView&) for every item in order
+    template <class F> bool merge(const vector<string>& files, F f) const {
+        size_t window = max(MIN_WINDOW / 4, budget() / 2 / (files.size() + 1));
+        vector<RunReader> readers(files.size());
+        vector<ItemView> heads(files.size());
+        auto later = [&](size_t a, size_t b) { //Heap order, ties go to the earlier run
+            if (before(heads[b], heads[a])) return true;
+            if (before(heads[a], heads[b])) return false;
+            return a > b;
+        };
+        vector<size_t> heap;
+        for (size_t r = 0; r < files.size(); ++r) {
+            if (!readers[r].open(files[r], window)) return false;
+            if (readers[r].next(heads[r])) heap.push_back(r);
+        }
+        make_heap(heap.begin(), heap.end(), later);
+        while (!heap.empty()) {
+            pop_heap(heap.begin(), heap.end(), later);
+            size_t r = heap.back();
+            f(heads[r]);
+            if (readers[r].next(heads[r])) push_heap(heap.begin(), heap.end(), later);
+            else heap.pop_back();
+        }
+        for (const auto& r : readers) if (!r.complete()) return false;
+        return true;
+    }
+    bool reduceRuns() { //Merges groups of runs until one final merge can take them all
+        while (runs.size() > fanIn()) {
+            vector<string> merged;
+            for (size_t first = 0; first < runs.size(); first += fanIn()) {
+                vector<string> group(runs.begin() + first, runs.begin() + min(runs.size(), first + fanIn()));
+                AsyncFileWriter w(writeBuffer());
+                string file = newRunName();
+                if (!w.open(file)) return false;
+                merged.push_back(file);
+                string rec;
+                bool ok = merge(group, [&](const ItemView& v) { rec.clear(); encodeItem(rec, v); putRecord(w, rec); });
+                if (!w.close() || !ok) { runs.insert(runs.end(), merged.begin(), merged.end()); return false; }
+                for (const auto& g : group) std::remove(g.c_str());
+            }
+            runs.swap(merged);
+        }
+        return true;
+    }
+    void removeRuns() {
+        for (const auto& r : runs) std::remove(r.c_str());
+        runs.clear();
+        records = 0;
+    }
+
+public:
+    explicit ExternalSort(ExternalSortOptions options = ExternalSortOptions()) : opt(move(options)) {}
+    ExternalSort(const ExternalSort&) = delete;
+    ExternalSort& operator=(const ExternalSort&) = delete;
+    ~ExternalSort() { removeRuns(); }
+
+    //Reads and spills the input, false if it cannot be read completely
+    bool sortRuns(const string& input) {
+        METRIC_TIMER("sort_runs");
+        removeRuns();
+        BinaryRecordStream in;
+        tableBytes = 0;
+        size_t window = max(MIN_WINDOW, opt.memoryBudget / 16);
+        if (!in.open(input, window)) return false;
+        tableBytes = in.tableBytes();
+        //What is left after the string table, the read window and the spill writer: two
+        //thirds for record bytes, the rest for entries and the scratch space of the merges in spill()
+        size_t room = max<size_t>(MIN_WINDOW, budget() - min(budget(), window + 2 * writeBuffer()));
+        string data;
+        vector<Entry> entries;
+        data.reserve(room / 3 * 2);
+        entries.reserve(max<size_t>(1, room / 3 / (2 * sizeof(Entry))));
+        WorkerPool pool(opt.threads);
+        bool ok = true;
+        ItemView v;
+        while (in.next(v)) {
+            size_t encoded = 17 + v.name.size() + (kindHasText(v.kind) ? 4 + v.text.size() : 4);
+            if (!entries.empty() && (entries.size() == entries.capacity() || data.capacity() - data.size() < encoded))
+                ok = spill(pool, data, entries) && ok;
+            Entry e{ v.price, data.size(), 0, (uint32_t)v.name.size() };
+            encodeItem(data, v);
+            e.length = (uint32_t)(data.size() - e.offset);
+            entries.push_back(e);
+            ++records;
+        }
+        if (!entries.empty()) ok = spill(pool, data, entries) && ok;
+        return ok && in.complete();
+    }
+    size_t runCount() const { return runs.size(); }
+    uint64_t size() const { return records; }
+
+    //Streams the sorted items to f(const ItemView&), views are only valid during the call
+    template <class F> bool forEachSorted(F f) {
+        METRIC_TIMER("sort_merge");
+        return reduceRuns() && merge(runs, f);
+    }
+    //Sorts input into output, a regular items.bin
+    bool sortFile(const string& input, const string& output) {
+        if (!sortRuns(input)) return false;
+        AsyncFileWriter w(writeBuffer());
+        if (!w.open(output)) return false;
+        LocalStringTable strings;
+        BinaryStringTable::writeHeader(w);
+        uint64_t n = 0;
+        bool ok = forEachSorted([&](const ItemView& v) { appendBinaryRecord(w.buffer(), v, strings); w.commit(); ++n; });
+        BinaryStringTable::writeFooter(w, strings.views(), n);
+        return w.close() && ok;
+    }
+};
+
+//Secondary lookups by name, Book author and Clothing size, kept in sync by
+//Container. Name keys are views into the items' own strings, author and size
+//keys are their pooled string handles.
+class NameIndex {
+    typedef unordered_multimap<string_view, const Item*> HashIndex;
+    typedef unordered_multimap<uint32_t, const Item*> HandleIndex;
+    HashIndex byName;
+    HandleIndex byAuthor, bySize;
+    multimap<string_view, const Item*> sortedNames; //Ordered for prefix searches
+
+    template <class Map, class Key> static void eraseEntry(Map& m, Key key, const Item* i) {
+        auto range = m.equal_range(key);
+        for (auto it = range.first; it != range.second; ++it)
+            if (it->second == i) { m.erase(it); return; }
+    }
+    template <class Map, class Key, class F> static void forEachIn(const Map& m, Key key, F f) {
+        auto range = m.equal_range(key);
+        for (auto it = range.first; it != range.second; ++it) f(*it->second);
+    }
+    template <class F> static void forEachIn(const HandleIndex& m, string_view key, F f) {
+        InternedString id;
+        if (InternedString::lookup(key, id)) forEachIn(m, id.handle(), f);
+    }
+public:
+    void clear() { byName.clear(); byAuthor.clear(); bySize.clear(); sortedNames.clear(); }
+    void reserve(size_t n) { byName.reserve(n); }
+    void insert(const Item* i) {
+        byName.emplace(i->getName(), i);
+        sortedNames.emplace(i->getName(), i);
+        if (i->kind() == ItemKind::Book) byAuthor.emplace(static_cast<const Book*>(i)->getAuthorId().handle(), i);
+        else if (i->kind() == ItemKind::Clothing) bySize.emplace(static_cast<const Clothing*>(i)->getSizeId().handle(), i);
+    }
+    void erase(const Item* i) {
+        eraseEntry(byName, i->getName(), i);
+        eraseEntry(sortedNames, i->getName(), i);
+        if (i->kind() == ItemKind::Book) eraseEntry(byAuthor, static_cast<const Book*>(i)->getAuthorId().handle(), i);
+        else if (i->kind() == ItemKind::Clothing) eraseEntry(bySize, static_cast<const Clothing*>(i)->getSizeId().handle(), i);
+    }
+
+    const Item* findByName(string_view name) const { //O(1) average, any one item with that name
+        auto it = byName.find(name);
+        return it == byName.end() ? nullptr : it->second;
+    }
+    template <class F> void forEachByName(string_view name, F f) const { forEachIn(byName, name, f); }
+    template <class F> void forEachByAuthor(string_view author, F f) const { forEachIn(byAuthor, author, f); }
+    template <class F> void forEachBySize(string_view size, F f) const { forEachIn(bySize, size, f); }
+    //Names starting with prefix in sorted order, at most limit of them, O(log n + k)
+    template <class F> void forEachWithPrefix(string_view prefix, size_t limit, F f) const {
+        for (auto it = sortedNames.lower_bound(prefix); it != sortedNames.end() && limit > 0; ++it, --limit) {
+            if (it->first.substr(0, prefix.size()) != prefix) break;
+            f(*it->second);
+        }
+    }
+};
+
+//Groceries by expiry date, so expired ones are found without scanning and parsing
+//the whole catalog. Items are filed in one bucket per day with the buckets in date
+//order, so taking everything that expires before a date only touches those items.
+//Each filed item also carries its position in the Container, which the Container
+//keeps current, so expired items can be removed without searching for them.
+//Erasing just forgets the item, its bucket entry is dropped when that day comes up
+//or when stale entries outnumber live ones.
+class ExpiryIndex {
+    struct Entry {
+        const Item* item;
+        uint64_t stamp; //Equals live[item].stamp while this is the item's current entry
+    };
+    struct Slot {
+        uint64_t stamp;
+        size_t pos;
+    };
+    map<uint32_t, vector<Entry>> days; //Keyed by Date::packed()
+    unordered_map<const Item*, Slot> live;
+    uint64_t nextStamp = 0;
+    size_t stale = 0;
+
+    static Date expiryOf(const Item* i) {
+        return i->kind() == ItemKind::Grocery ? static_cast<const Grocery*>(i)->getExpiryDate() : Date();
+    }
+    bool current(const Entry& e) const {
+        auto it = live.find(e.item);
+        return it != live.end() && it->second.stamp == e.stamp;
+    }
+    void compact() {
+        days.clear();
+        stale = 0;
+        for (const auto& l : live) days[expiryOf(l.first).packed()].push_back(Entry{ l.first, l.second.stamp });
+    }
+public:
+    void insert(const Item* i, size_t pos) { //Only Groceries with a valid YYYY-MM-DD expiry are filed
+        Date d = expiryOf(i);
+        if (!d.valid() || !live.emplace(i, Slot{ nextStamp, pos }).second) return;
+        days[d.packed()].push_back(Entry{ i, nextStamp++ });
+    }
+    void relocate(const Item* i, size_t pos) { //The item now sits at pos, a no-op for items not filed
+        auto it = live.find(i);
+        if (it != live.end()) it->second.pos = pos;
+    }
+    void erase(const Item* i) {
+        if (live.erase(i) && ++stale > live.size() + 1024) compact();
+    }
+    void clear() { days.clear(); live.clear(); stale = 0; }
+    template <class Items> void rebuild(const Items& items) {
+        clear();
+        for (size_t k = 0; k < items.size(); ++k) insert(&*items[k], k);
+    }
+    size_t size() const { return live.size(); }
+
+    //Calls f(const Item&) for every item expiring before cutoff, earliest first
+    template <class F> void forEachBefore(Date cutoff, F f) const {
+        for (auto it = days.begin(); it != days.end() && it->first < cutoff.packed(); ++it)
+            for (const Entry& e : it->second) if (current(e)) f(*e.item);
+    }
+    //Calls f(const Item&, size_t pos) for the same items, which leave the index first.
+    //f may relocate() other items.
+    template <class F> void popBefore(Date cutoff, F f) {
+        for (auto it = days.begin(); it != days.end() && it->first < cutoff.packed(); it = days.erase(it))
+            for (const Entry& e : it->second) {
+                auto l = live.find(e.item);
+                if (l == live.end() || l->second.stamp != e.stamp) { --stale; continue; }
+                size_t pos = l->second.pos;
+                live.erase(l);
+                f(*e.item, pos);
+            }
+    }
+};
+
+//Owning pointer that can hold either a heap item or one placed in an ItemArena.
+//Arena items are never destroyed individually, the arena releases them all at once.
+struct ItemDeleter {
+    bool inArena = false;
+    void operator()(Item* i) const { if (!inArena) delete i; }
+};
+typedef unique_ptr<Item, ItemDeleter> ItemPtr;
+
+//Layout of a saved items.bin, loading tells them apart by the leading magic
+enum class BinaryFormat {
+    Plain,     //Records as they are, see BinaryStringTable
+    Compressed //Blocks of records, see CompressedCatalog
+};
+
+//items.bin writer and reader shared by the blocking and background paths. Items
+//is any range of ItemPtr or const Item*, job (if given) counts items done.
+template <class Items> bool writeItemsBinary(const string& file, const Items& items, IoJob* job = nullptr,
+                                             BinaryFormat format = BinaryFormat::Plain) {
+    METRIC_TIMER("save_binary");
+    AsyncFileWriter w;
+    if (!w.open(file)) return false;
+    BinaryStringTable strings;
+    size_t n = 0;
+    auto writeRecords = [&](auto& out) {
+        for (const auto& i : items) {
+            i->persistBinary(out.buffer(), strings);
+            out.commit();
+            if (job && ++n % 1024 == 0) job->advance(1024);
+        }
+    };
+    if (format == BinaryFormat::Compressed) {
+        CompressedBlockWriter blocks(w);
+        writeRecords(blocks);
+        blocks.finish(strings, items.size());
+    } else {
+        BinaryStringTable::writeHeader(w);
+        writeRecords(w);
+        strings.writeFooter(w, items.size());
+    }
+    bool ok = w.close();
+    METRIC_COUNT("bytes_written", w.bytesWritten());
+    if (job) job->advance(n % 1024);
+    return ok;
+}
+bool readItemsBinary(const string& file, ItemArena& arena, vector<ItemPtr>& out, IoJob* job = nullptr) {
+    METRIC_TIMER("load_binary");
+    CatalogView view;
+    if (!view.open(file)) return false;
+    if (job) job->setTotal(view.size());
+    out.reserve(view.size());
+    for (size_t i = 0; i < view.size(); ++i) {
+        out.push_back(ItemPtr(view[i].materialize(arena), ItemDeleter{ true }));
+        if (job && (i + 1) % 1024 == 0) job->advance(1024);
+    }
+    if (job) job->advance(view.size() % 1024);
+    return true;
+}
+//Rewrites an items.bin of either layout in the given one, in may be out
+bool repackBinary(const string& in, const string& out, BinaryFormat format) {
+    ItemArena arena;
+    vector<ItemPtr> items;
+    return readItemsBinary(in, arena, items) && writeItemsBinary(out, items, nullptr, format);
 }
 
+bool readItemsColumnar(const string& file, ItemArena& arena, vector<ItemPtr>& out, uint64_t* journalSeq = nullptr) {
+    ColumnarCatalog cat;
+    if (!cat.open(file)) return false;
+    if (journalSeq) *journalSeq = cat.sequence();
+    out.reserve(cat.size());
+    cat.forEach([&](const ItemView& v) { out.push_back(ItemPtr(v.materialize(arena), ItemDeleter{ true })); });
+    return true;
+}
+
+//Items read by loadBinaryAsync(), swapped into a Container by finishLoad()
+struct BinaryLoad {
+    shared_ptr<ItemArena> arena = make_shared<ItemArena>();
+    shared_ptr<vector<ItemPtr>> items = make_shared<vector<ItemPtr>>();
+    IoJob job; //Declared last so its thread is joined before the results go away
+};
+
+
+//Outcome of Container::ingest(), lines are numbered from 1
+struct IngestReject {
+    size_t line;
+    string message;
+};
+struct IngestResult {
+    size_t added = 0;
+    vector<IngestReject> rejects;
+};
 
 //Container class
 class Container { 
-    shared_ptr<vector<unique_ptr<Item>>> items; //Holds all items
+    shared_ptr<ItemArena> arena;        //Backing memory for items created through emplace() and the loaders
+    shared_ptr<vector<ItemPtr>> items;  //Holds all items
+    shared_ptr<PriceIndex> byPrice;     //Indexes are shared along with items so copies stay consistent
+    shared_ptr<NameIndex> byName;
+    shared_ptr<ExpiryIndex> byExpiry;
+    Journal* journal = nullptr;         //Receives every change when set
+    vector<shared_ptr<IoJob>> saving;   //Background saves that may still read the items
+    size_t droppedInArena = 0;          //Items removed or replaced whose arena memory is still held
+    friend class ConcurrentContainer;
+
+    void indexItem(const Item* i, size_t pos) { byPrice->insert(i); byName->insert(i); byExpiry->insert(i, pos); }
+    void unindexItem(const Item* i) { byPrice->erase(i); byName->erase(i); byExpiry->erase(i); }
+    void rebuildIndexes() {
+        byPrice->rebuild(*items);
+        byExpiry->rebuild(*items);
+        byName->clear();
+        byName->reserve(items->size());
+        for (const auto& i : *items) byName->insert(i.get());
+    }
+    void adopt(Item* i) { indexItem(i, items->size()); items->push_back(ItemPtr(i, ItemDeleter{ true })); }
+    //Called before an item is dropped: while a background save is running the item
+    //is handed to it and freed only when that save is gone
+    void retire(ItemPtr& p) {
+        droppedInArena += p.get_deleter().inArena;
+        saving.erase(remove_if(saving.begin(), saving.end(), [](const shared_ptr<IoJob>& j) { return j->ready(); }), saving.end());
+        if (saving.empty()) return;
+        ItemDeleter d = p.get_deleter();
+        shared_ptr<Item> kept(p.release(), d);
+        for (auto& j : saving) j->retain(kept);
+    }
+    void log(char op, uint64_t index, const Item* i) {
+        if (!journal) return;
+        string rec(1, op);
+        if (op != 'A') for (int b = 0; b < 8; ++b) rec.push_back((char)(index >> (8 * b)));
+        if (i) encodeItem(rec, viewOf(*i));
+        journal->append(rec);
+    }
+    void replace(size_t index, ItemPtr p) {
+        unindexItem((*items)[index].get());
+        indexItem(p.get(), index);
+        retire((*items)[index]);
+        (*items)[index] = move(p);
+        reclaimArena();
+    }
+    void eraseAt(size_t index) { //Keeps the order in O(n), for 'R' records of older logs
+        unindexItem((*items)[index].get());
+        retire((*items)[index]);
+        items->erase(items->begin() + index);
+        for (size_t k = index; k < items->size(); ++k) byExpiry->relocate((*items)[k].get(), k);
+    }
+    void swapRemove(size_t index) { //O(log n) removal that fills the gap with the last item
+        log('S', index, nullptr);
+        unindexItem((*items)[index].get());
+        retire((*items)[index]);
+        if (index + 1 != items->size()) {
+            (*items)[index] = move(items->back());
+            byExpiry->relocate((*items)[index].get(), index);
+        }
+        items->pop_back();
+    }
+    //Arena items are only freed together with their arena. Once the dropped ones
+    //outnumber the live ones, the live ones are copied to a new arena and the old
+    //one goes, so the arena stays within about twice the live items and each
+    //copy is paid for by as many drops. Item references are invalidated as by a load.
+    //Expiry, size and author strings stay in the global StringPool, which grows with
+    //the number of distinct values (one per calendar day for expiries), not with drops.
+    void reclaimArena() {
+        if (droppedInArena < 4096 || droppedInArena < items->size()) return;
+        auto a = make_shared<ItemArena>();
+        auto v = make_shared<vector<ItemPtr>>();
+        v->reserve(items->size());
+        for (const auto& i : *items) v->push_back(ItemPtr(viewOf(*i).materialize(*a), ItemDeleter{ true }));
+        replaceContents(move(a), move(v)); //A running save keeps the old arena alive
+    }
+    //Loaders build the new contents on the side and swap them in, so copies of this
+    //Container that share the old vector keep seeing the old contents intact
+    void replaceContents(shared_ptr<ItemArena> a, shared_ptr<vector<ItemPtr>> v) {
+        items = move(v);
+        arena = move(a);
+        byPrice = make_shared<PriceIndex>();
+        byName = make_shared<NameIndex>();
+        byExpiry = make_shared<ExpiryIndex>();
+        droppedInArena = 0;
+        rebuildIndexes();
+    }
 public:
-    Container() : items(make_shared<vector<unique_ptr<Item>>>()) {}
-    //Adds, prints, saved, loads all items and gives access for the priority queue
-    void add(unique_ptr<Item> i) { items->push_back(move(i)); }
-    void showAll() const { for (const auto& i : *items) i->display(); }
-    void saveBinary(const string& file) {
-        ofstream ofs(file, ios::binary);
-        for (const auto& i : *items) {
-            size_t len = i->getType().size();
-            ofs.write((char*)&len, sizeof(len));
-            ofs.write(i->getType().c_str(), len);
-            i->persistBinary(ofs);
+    Container() : arena(make_shared<ItemArena>()), items(make_shared<vector<ItemPtr>>()),
+                  byPrice(make_shared<PriceIndex>()), byName(make_shared<NameIndex>()), byExpiry(make_shared<ExpiryIndex>()) {}
+    //Adds, removes, prints, saves, loads all items and answers price and name queries
+    void add(unique_ptr<Item> i) { log('A', 0, i.get()); indexItem(i.get(), items->size()); items->push_back(ItemPtr(i.release())); }
+    template <class T, class... Args> T& emplace(Args&&... args) { //Builds the item inside the container's arena
+        T* i = arena->make<T>(forward<Args>(args)...);
+        log('A', 0, i);
+        adopt(i);
+        return *i;
+    }
+    Item& add(const ItemView& v) { //Builds a copy of v in the container's arena
+        Item* i = v.materialize(*arena);
+        log('A', 0, i);
+        adopt(i);
+        return *i;
+    }
+    void update(size_t index, unique_ptr<Item> i) {
+        log('U', index, i.get());
+        replace(index, ItemPtr(i.release()));
+    }
+    void remove(size_t index) { //O(log n), the last item takes the removed one's place
+        swapRemove(index);
+        reclaimArena();
+    }
+
+    //Removes every Grocery expiring before cutoff and returns how many went, in
+    //O(expired log n): the index hands over the expired items with their positions
+    //and each gap is filled with the last item, so the order of the rest changes.
+    size_t evictExpired(Date cutoff) {
+        size_t evicted = 0;
+        byExpiry->popBefore(cutoff, [&](const Item&, size_t pos) { swapRemove(pos); ++evicted; });
+        reclaimArena();
+        return evicted;
+    }
+
+    //Write-ahead logging: once attached, every add/update/remove is appended to the journal
+    void setJournal(Journal* j) { journal = j; }
+    bool applyJournalRecord(string_view rec) { //Replays one record (without logging it again)
+        Journal* saved = journal;
+        journal = nullptr;
+        bool ok = false;
+        if (!rec.empty()) {
+            char op = rec[0];
+            rec.remove_prefix(1);
+            uint64_t index = 0;
+            if (op != 'A' && rec.size() >= 8) {
+                for (int b = 0; b < 8; ++b) index |= (uint64_t)(uint8_t)rec[b] << (8 * b);
+                rec.remove_prefix(8);
+            }
+            ItemView v;
+            if (op == 'A' && decodeItem(rec, v)) { adopt(v.materialize(*arena)); ok = true; }
+            else if (op == 'U' && index < size() && decodeItem(rec, v)) { replace(index, ItemPtr(v.materialize(*arena), ItemDeleter{ true })); ok = true; }
+            else if (op == 'R' && index < size()) { eraseAt(index); reclaimArena(); ok = true; }
+            else if (op == 'S' && index < size()) { swapRemove(index); ok = true; }
         }
+        journal = saved;
+        return ok;
+    }
+    //Writes a snapshot of the current contents to file in the background and trims the journal
+    void compactJournal(const string& file) {
+        if (!journal) return;
+        uint64_t seq = journal->lastSeq();
+        ColumnarWriter w;
+        for (const auto& i : *items) w.add(*i);
+        string snapshot;
+        w.serialize(snapshot, nullptr, seq);
+        journal->compact(seq, move(snapshot), file);
+    }
+    size_t size() const { return items->size(); }
+    void showAll(OutputBuffer& out = threadOutput()) const { //Insertion order, written out in large blocks
+        for (const auto& i : *items) i->format(out);
+        out.flush();
+    }
+    void showByPrice(OutputBuffer& out = threadOutput()) const { //Most expensive first
+        METRIC_TIMER("show_by_price");
+        byPrice->topK(size(), [&](const Item& i) { i.format(out); });
+        out.flush();
+    }
+    bool saveBinary(const string& file, BinaryFormat format = BinaryFormat::Plain) const { return writeItemsBinary(file, *items, nullptr, format); }
+    void loadBinary(const string& file) { //Either format
+        auto a = make_shared<ItemArena>();
+        auto v = make_shared<vector<ItemPtr>>();
+        readItemsBinary(file, *a, *v);
+        replaceContents(move(a), move(v));
     }
-    void loadBinary(const string& file) {
-        ifstream ifs(file, ios::binary);
-        items->clear();
-        while (ifs.peek() != EOF) {
-            auto i = Item::restoreBinary(ifs);
-            if (i) items->push_back(move(i));
+    //Saves the current contents on a background thread. The container stays usable:
+    //later changes are not part of the file, and items removed or replaced meanwhile
+    //are kept alive until the save is done.
+    shared_ptr<IoJob> saveBinaryAsync(const string& file, BinaryFormat format = BinaryFormat::Plain) {
+        auto snapshot = make_shared<vector<const Item*>>();
+        snapshot->reserve(items->size());
+        for (const auto& i : *items) snapshot->push_back(i.get());
+        auto job = make_shared<IoJob>();
+        job->setTotal(snapshot->size());
+        job->retain(arena); //A load in the meantime replaces both
+        job->retain(items);
+        job->start([file, snapshot, format](IoJob& j) { return writeItemsBinary(file, *snapshot, &j, format); });
+        saving.push_back(job);
+        return job;
+    }
+    shared_ptr<BinaryLoad> loadBinaryAsync(const string& file) const { //Reads in the background, see finishLoad()
+        auto l = make_shared<BinaryLoad>();
+        BinaryLoad* raw = l.get();
+        l->job.start([raw, file](IoJob& j) { return readItemsBinary(file, *raw->arena, *raw->items, &j); });
+        return l;
+    }
+    //Swaps the loaded items in, false while the load is still running. A failed load
+    //(l.job.wait() is false) leaves the contents alone.
+    bool finishLoad(BinaryLoad& l) {
+        if (!l.job.ready()) return false;
+        if (l.job.wait()) replaceContents(l.arena, l.items);
+        return true;
+    }
+    void saveColumnar(const string& file) const {
+        ColumnarWriter w;
+        for (const auto& i : *items) w.add(*i);
+        w.write(file, journal ? journal->lastSeq() : 0);
+    }
+    bool loadColumnar(const string& file, uint64_t* journalSeq = nullptr) {
+        auto a = make_shared<ItemArena>();
+        auto v = make_shared<vector<ItemPtr>>();
+        if (!readItemsColumnar(file, *a, *v, journalSeq)) return false;
+        replaceContents(move(a), move(v));
+        return true;
+    }
+    //Bulk insert of "TYPE|name|price|field" lines (the items.txt format) from in.
+    //Input is read and parsed in large blocks straight into the arena, the parsed
+    //items go in as one batch, and bad lines are reported without stopping it.
+    IngestResult ingest(istream& in) {
+        METRIC_TIMER("ingest");
+        const size_t BLOCK = 1 << 20;
+        IngestResult r;
+        vector<Item*> batch;
+        string block, carry, error;
+        size_t lineNo = 0;
+        while (in || !carry.empty()) {
+            block = move(carry);
+            carry.clear();
+            size_t old = block.size();
+            if (in) {
+                block.resize(old + BLOCK);
+                in.read(&block[old], BLOCK);
+                block.resize(old + (size_t)in.gcount());
+                if (in) { //Only complete lines now, the rest waits for the next block
+                    size_t nl = block.rfind('\n');
+                    if (nl == string::npos) { carry = move(block); continue; }
+                    carry.assign(block, nl + 1, string::npos);
+                    block.resize(nl + 1);
+                }
+            }
+            batch.reserve(batch.size() + count(block.begin(), block.end(), '\n') + 1);
+            string_view rest(block);
+            while (!rest.empty()) {
+                size_t nl = rest.find('\n');
+                string_view line = rest.substr(0, nl);
+                rest.remove_prefix(nl == string_view::npos ? rest.size() : nl + 1);
+                ++lineNo;
+                if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+                if (line.empty() || line[0] == '#') continue;
+                ItemView v;
+                if (parseTextRecord(line, v, &error)) batch.push_back(v.materialize(*arena));
+                else r.rejects.push_back(IngestReject{ lineNo, error });
+            }
+        }
+        METRIC_COUNT("records_parsed", batch.size());
+        METRIC_COUNT("parse_errors", r.rejects.size());
+
+        items->reserve(items->size() + batch.size());
+        size_t first = items->size();
+        for (Item* i : batch) {
+            log('A', 0, i);
+            items->push_back(ItemPtr(i, ItemDeleter{ true }));
         }
+        if (batch.size() > items->size() / 2) rebuildIndexes(); //Cheaper than inserting one by one
+        else for (size_t k = 0; k < batch.size(); ++k) indexItem(batch[k], first + k);
+        r.added = batch.size();
+        return r;
     }
-    vector<unique_ptr<Item>>& getItems() { return *items; }
+    const vector<ItemPtr>& getItems() const { return *items; }
+
+    //Price queries answered from the index in O(log n + k), f is called with const Item&
+    template <class F> void topByPrice(size_t k, F f) const { byPrice->topK(k, f); }
+    template <class F> void inPriceRange(double minPrice, double maxPrice, F f) const { byPrice->inRange(minPrice, maxPrice, f); }
+    size_t priceRank(double price) const { return byPrice->rank(price); }
+    const Item* nthMostExpensive(size_t r) const { return byPrice->at(r); }
+
+    //Name, author and size lookups answered from the hash and prefix indexes
+    const Item* findByName(string_view name) const { return byName->findByName(name); }
+    template <class F> void forEachByName(string_view name, F f) const { byName->forEachByName(name, f); }
+    template <class F> void booksByAuthor(string_view author, F f) const { byName->forEachByAuthor(author, f); }
+    template <class F> void clothingBySize(string_view size, F f) const { byName->forEachBySize(size, f); }
+    template <class F> void autocomplete(string_view prefix, size_t limit, F f) const { byName->forEachWithPrefix(prefix, limit, f); }
+
+    //Groceries expiring before cutoff, earliest first, in O(expired) from the expiry index
+    template <class F> void expiringBefore(Date cutoff, F f) const { byExpiry->forEachBefore(cutoff, f); }
 };
 
-//Main class
-int main() {
+//Catalog that request threads can read while other threads change it. Writers go
+//through one Container (journal, indexes, eviction) under a mutex. Readers take an
+//immutable Snapshot of the item list out of a SnapshotCell, without locking or
+//waiting on a writer, and keep it as long as they like. A snapshot copies the item
+//pointers, so changes are published in batches: once batchSize of them are pending,
+//on publish(), and right away for bulk changes (loads, ingest, eviction). Every item
+//is built in the Container's arena and a snapshot holds on to that arena, so the
+//items it lists stay valid after the catalog drops them. Reloads parse without the
+//lock and swap the new contents in.
+class ConcurrentContainer {
+public:
+    class Snapshot {
+        vector<const Item*> items;
+        shared_ptr<ItemArena> arena; //Holds every item listed
+        friend class ConcurrentContainer;
+    public:
+        size_t size() const { return items.size(); }
+        const Item& operator[](size_t i) const { return *items[i]; }
+        template <class F> void forEach(F f) const { for (const Item* i : items) f(*i); }
+        void showAll(OutputBuffer& out = threadOutput()) const {
+            for (const Item* i : items) i->format(out);
+            out.flush();
+        }
+    };
+
+private:
     Container c;
+    mutable mutex writer; //Serialises writers and index queries, snapshot readers never take it
+    SnapshotCell<Snapshot> current;
+    size_t batchSize, pending = 0;
+
+    void publishLocked() { //Copies all n item pointers, so O(n) per publish: callers batch
+        auto next = make_shared<Snapshot>();
+        next->arena = c.arena;
+        next->items.reserve(c.items->size());
+        for (const auto& i : *c.items) next->items.push_back(i.get());
+        current.store(move(next));
+        pending = 0;
+    }
+    void changedLocked() { if (++pending >= batchSize) publishLocked(); }
+    bool swapIn(shared_ptr<ItemArena> a, shared_ptr<vector<ItemPtr>> v) {
+        lock_guard<mutex> lock(writer);
+        c.replaceContents(move(a), move(v));
+        publishLocked();
+        return true;
+    }
+
+public:
+    explicit ConcurrentContainer(size_t batch = 1024) : batchSize(max<size_t>(batch, 1)) {}
+    ConcurrentContainer(const ConcurrentContainer&) = delete;
+    ConcurrentContainer& operator=(const ConcurrentContainer&) = delete;
+
+    //Readers: a consistent view of the last published contents
+    shared_ptr<const Snapshot> snapshot() const { return current.load(); }
+    size_t size() const { return snapshot()->size(); }
+    //Index queries see the latest contents, they run under the writer lock with a
+    //const Container&. Writers wait for f, so anything slow belongs in select().
+    template <class F> auto query(F f) const {
+        lock_guard<mutex> lock(writer);
+        return f(static_cast<const Container&>(c));
+    }
+    //Runs q(const Container&, emit) under the lock and returns the items it passes to
+    //emit as a Snapshot, for printing or other slow work once the lock is released
+    template <class Q> shared_ptr<const Snapshot> select(Q q) const {
+        auto s = make_shared<Snapshot>();
+        lock_guard<mutex> lock(writer);
+        s->arena = c.arena;
+        q(static_cast<const Container&>(c), [&](const Item& i) { s->items.push_back(&i); });
+        return s;
+    }
+
+    //Writers, indexes are positions in the latest contents
+    void add(const ItemView& v) {
+        lock_guard<mutex> lock(writer);
+        c.add(v);
+        changedLocked();
+    }
+    void add(const Item& i) { add(viewOf(i)); } //Copied into the arena
+    template <class T, class... Args> void emplace(Args&&... args) {
+        lock_guard<mutex> lock(writer);
+        c.emplace<T>(forward<Args>(args)...);
+        changedLocked();
+    }
+    void remove(size_t index) {
+        lock_guard<mutex> lock(writer);
+        c.remove(index);
+        changedLocked();
+    }
+    size_t evictExpired(Date cutoff) {
+        lock_guard<mutex> lock(writer);
+        size_t n = c.evictExpired(cutoff);
+        if (n) publishLocked();
+        return n;
+    }
+    IngestResult ingest(istream& in) {
+        lock_guard<mutex> lock(writer);
+        IngestResult r = c.ingest(in);
+        publishLocked();
+        return r;
+    }
+    void publish() { //Makes every pending change visible
+        lock_guard<mutex> lock(writer);
+        if (pending) publishLocked();
+    }
+
+    //Reloads, false if the file cannot be read
+    bool loadBinary(const string& file) {
+        auto a = make_shared<ItemArena>();
+        auto v = make_shared<vector<ItemPtr>>();
+        return readItemsBinary(file, *a, *v) && swapIn(move(a), move(v));
+    }
+    bool loadColumnar(const string& file, uint64_t* journalSeq = nullptr) {
+        auto a = make_shared<ItemArena>();
+        auto v = make_shared<vector<ItemPtr>>();
+        return readItemsColumnar(file, *a, *v, journalSeq) && swapIn(move(a), move(v));
+    }
+
+    //Journal and persistence, see Container
+    void setJournal(Journal* j) {
+        lock_guard<mutex> lock(writer);
+        c.setJournal(j);
+    }
+    bool applyJournalRecord(string_view rec) {
+        lock_guard<mutex> lock(writer);
+        bool ok = c.applyJournalRecord(rec);
+        if (ok) changedLocked();
+        return ok;
+    }
+    void compactJournal(const string& file) {
+        lock_guard<mutex> lock(writer);
+        c.compactJournal(file);
+    }
+    shared_ptr<IoJob> saveBinaryAsync(const string& file, BinaryFormat format = BinaryFormat::Plain) {
+        lock_guard<mutex> lock(writer);
+        return c.saveBinaryAsync(file, format);
+    }
+};
+
+//Evicts expired groceries from a ConcurrentContainer, once when constructed and then
+//every interval on a background thread. firstGoodDay gives the cutoff, items
+//expiring before it go.
+class ExpirySweeper {
+    ConcurrentContainer& c;
+    chrono::milliseconds interval;
+    function<Date()> firstGoodDay;
+    mutex m;
+    condition_variable cv;
+    bool stopping = false;
+    atomic<size_t> evicted{ 0 };
+    thread worker;
+
+    void sweep() { evicted += c.evictExpired(firstGoodDay()); }
+    void run() {
+        unique_lock<mutex> wait(m);
+        while (!cv.wait_for(wait, interval, [&] { return stopping; })) {
+            wait.unlock();
+            sweep();
+            wait.lock();
+        }
+    }
+public:
+    ExpirySweeper(ConcurrentContainer& container, chrono::milliseconds every, function<Date()> cutoff = Date::today)
+        : c(container), interval(every), firstGoodDay(move(cutoff)) {
+        sweep();
+        worker = thread([this] { run(); });
+    }
+    ExpirySweeper(const ExpirySweeper&) = delete;
+    ExpirySweeper& operator=(const ExpirySweeper&) = delete;
+    ~ExpirySweeper() { stop(); }
+
+    void stop() { //Lets a running sweep finish, then no more
+        {
+            lock_guard<mutex> guard(m);
+            stopping = true;
+        }
+        cv.notify_all();
+        if (worker.joinable()) worker.join();
+    }
+    size_t takeEvicted() { return evicted.exchange(0); } //Items evicted since the last call
+};
+
+//What a report should compute
+struct ReportOptions {
+    double histogramMin = 0.0, histogramMax = 1000.0; //Price range split into histogramBuckets equal buckets
+    size_t histogramBuckets = 10;
+    string expiryBefore;      //Count Groceries expiring before this YYYY-MM-DD date, empty or invalid skips it
+    size_t warrantyBuckets = 6; //Buckets 0..n-2 are exact years, the last one is n-1 years or more
+};
+
+//Structured result of a catalog report
+struct CatalogReport {
+    struct TypeTotals {
+        size_t count = 0;
+        double total = 0.0;
+        double average() const { return count ? total / count : 0.0; }
+    };
+    array<TypeTotals, ITEM_KIND_COUNT> byType{};
+    vector<size_t> priceHistogram;     //Bucket b covers [min + b * width, min + (b + 1) * width)
+    double histogramMin = 0.0, histogramWidth = 0.0;
+    size_t belowHistogram = 0, aboveHistogram = 0;
+    size_t groceriesExpiringBefore = 0;
+    vector<size_t> electronicsByWarranty;
+
+    CatalogReport() = default;
+    explicit CatalogReport(const ReportOptions& opt)
+        : priceHistogram(max<size_t>(opt.histogramBuckets, 1)), histogramMin(opt.histogramMin),
+          histogramWidth((opt.histogramMax - opt.histogramMin) / max<size_t>(opt.histogramBuckets, 1)),
+          electronicsByWarranty(max<size_t>(opt.warrantyBuckets, 1)) {}
+
+    void addPrice(ItemKind k, double price) {
+        TypeTotals& t = byType[(int)k];
+        ++t.count;
+        t.total += price;
+        double b = floor((price - histogramMin) / histogramWidth);
+        if (!(b >= 0)) ++belowHistogram; //Also catches NaN prices
+        else if (b >= (double)priceHistogram.size()) ++aboveHistogram;
+        else ++priceHistogram[(size_t)b];
+    }
+    void addWarranty(int years) { ++electronicsByWarranty[min<size_t>((size_t)max(years, 0), electronicsByWarranty.size() - 1)]; }
+    void merge(const CatalogReport& o) {
+        for (int k = 0; k < ITEM_KIND_COUNT; ++k) { byType[k].count += o.byType[k].count; byType[k].total += o.byType[k].total; }
+        for (size_t b = 0; b < priceHistogram.size(); ++b) priceHistogram[b] += o.priceHistogram[b];
+        belowHistogram += o.belowHistogram;
+        aboveHistogram += o.aboveHistogram;
+        groceriesExpiringBefore += o.groceriesExpiringBefore;
+        for (size_t b = 0; b < electronicsByWarranty.size(); ++b) electronicsByWarranty[b] += o.electronicsByWarranty[b];
+    }
+};
+
+//Computes CatalogReports as parallel reductions on a WorkerPool, each thread
+//folding a contiguous slice into its own partial report. Groceries whose expiry
+//is not a valid date never count as expiring.
+class ReportEngine {
+    WorkerPool& pool;
+    static void mergeInto(CatalogReport& total, const CatalogReport& part) { total.merge(part); }
+public:
+    explicit ReportEngine(WorkerPool& p) : pool(p) {}
+
+    //Column at a time over the struct-of-arrays store, no virtual calls
+    CatalogReport run(const ItemStore& store, const ReportOptions& opt = ReportOptions()) const {
+        const vector<double>& prices = store.priceColumn();
+        CatalogReport report = parallelReduce(pool, store.size(), CatalogReport(opt),
+            [&](CatalogReport& r, size_t i) { r.addPrice(store.kind(i), prices[i]); }, mergeInto);
+        const vector<int>& warranty = store.warrantyColumn();
+        report.merge(parallelReduce(pool, warranty.size(), CatalogReport(opt),
+            [&](CatalogReport& r, size_t i) { r.addWarranty(warranty[i]); }, mergeInto));
+        Date cutoff = Date::parse(opt.expiryBefore);
+        if (cutoff.valid()) {
+            const vector<Date>& expiry = store.expiryDateColumn();
+            report.groceriesExpiringBefore = parallelReduce(pool, expiry.size(), size_t(0),
+                [&](size_t& count, size_t i) { count += expiry[i].valid() && expiry[i] < cutoff; },
+                [](size_t& total, size_t part) { total += part; });
+        }
+        return report;
+    }
+
+    //Single pass over the items held by a Container
+    CatalogReport run(const Container& c, const ReportOptions& opt = ReportOptions()) const {
+        const vector<ItemPtr>& items = c.getItems();
+        Date cutoff = Date::parse(opt.expiryBefore);
+        return parallelReduce(pool, items.size(), CatalogReport(opt), [&](CatalogReport& r, size_t i) {
+            const Item& item = *items[i];
+            ItemKind k = item.kind();
+            r.addPrice(k, item.getPrice());
+            if (k == ItemKind::Electronics) r.addWarranty(static_cast<const Electronics&>(item).getWarranty());
+            else if (k == ItemKind::Grocery && cutoff.valid()) {
+                Date d = static_cast<const Grocery&>(item).getExpiryDate();
+                r.groceriesExpiringBefore += d.valid() && d < cutoff;
+            }
+        }, mergeInto);
+    }
+};
 
-    //Load items if exist
-    ifstream test("items.bin", ios::binary);
-    if (test) {
-        test.close();
-        c.loadBinary("items.bin");
+#ifndef SHOPPING_ITEMS_UPDATED_NO_MAIN
+//Main class
+int main(int argc, char* argv[]) {
+    METRICS_DUMP_AT_EXIT();
+    //Converters: --convert-bin items.bin items.cat or --convert-txt items.txt items.cat
+    if (argc == 4 && (string(argv[1]) == "--convert-bin" || string(argv[1]) == "--convert-txt")) {
+        bool ok = string(argv[1]) == "--convert-bin" ? convertLegacyBinary(argv[2], argv[3]) : convertText(argv[2], argv[3]);
+        cout << (ok ? "Converted " : "Could not convert ") << argv[2] << " to " << argv[3] << "\n";
+        return ok ? 0 : 1;
+    }
+
+    //Layout change: --repack items.bin packed.bin [compressed|plain], compressed by default
+    if ((argc == 4 || argc == 5) && string(argv[1]) == "--repack") {
+        string layout = argc == 5 ? argv[4] : "compressed";
+        if (layout != "compressed" && layout != "plain") { cerr << "Unknown layout " << layout << "\n"; return 1; }
+        bool ok = repackBinary(argv[2], argv[3], layout == "plain" ? BinaryFormat::Plain : BinaryFormat::Compressed);
+        cout << (ok ? "Repacked " : "Could not repack ") << argv[2] << " to " << argv[3] << "\n";
+        return ok ? 0 : 1;
     }
 
+    //Report: --report items.cat [expiry cutoff YYYY-MM-DD]
+    if ((argc == 3 || argc == 4) && string(argv[1]) == "--report") {
+        ItemStore store;
+        if (!store.loadColumnar(argv[2])) { cerr << "Cannot read " << argv[2] << "\n"; return 1; }
+        ReportOptions opt;
+        if (argc == 4) opt.expiryBefore = argv[3];
+        WorkerPool pool;
+        CatalogReport r = ReportEngine(pool).run(store, opt);
+        for (int k = 0; k < ITEM_KIND_COUNT; ++k)
+            cout << itemType((ItemKind)k).name << ": " << r.byType[k].count << " item(s), total " << r.byType[k].total
+                 << ", average " << r.byType[k].average() << "\n";
+        for (size_t b = 0; b < r.priceHistogram.size(); ++b)
+            cout << "Price " << r.histogramMin + b * r.histogramWidth << "-" << r.histogramMin + (b + 1) * r.histogramWidth
+                 << ": " << r.priceHistogram[b] << "\n";
+        cout << "Price outside the histogram: " << r.belowHistogram + r.aboveHistogram << "\n";
+        for (size_t b = 0; b < r.electronicsByWarranty.size(); ++b)
+            cout << "Warranty " << b << (b + 1 == r.electronicsByWarranty.size() ? "+" : "") << "y: " << r.electronicsByWarranty[b] << "\n";
+        if (argc == 4) cout << "Groceries expiring before " << opt.expiryBefore << ": " << r.groceriesExpiringBefore << "\n";
+        return 0;
+    }
+
+    //Out-of-core sort: --sort items.bin sorted.bin [price-desc|price|name] [memory budget in MiB]
+    if (argc >= 4 && argc <= 6 && string(argv[1]) == "--sort") {
+        ExternalSortOptions opt;
+        if (argc >= 5) {
+            string key = argv[4];
+            if (key == "price") opt.key = SortKey::PriceAscending;
+            else if (key == "name") opt.key = SortKey::Name;
+            else if (key != "price-desc") { cerr << "Unknown sort key " << key << "\n"; return 1; }
+        }
+        if (argc == 6) opt.memoryBudget = (size_t)max(1, atoi(argv[5])) << 20;
+        ExternalSort sorter(opt);
+        if (!sorter.sortFile(argv[2], argv[3])) { cerr << "Could not sort " << argv[2] << " into " << argv[3] << "\n"; return 1; }
+        cout << "Sorted " << sorter.size() << " item(s) into " << argv[3] << "\n";
+        return 0;
+    }
+
+    ConcurrentContainer c; //The menu reads snapshots while the expiry sweeper writes
+
+    //Load items if exist, falling back to the old per-record format
+    uint64_t snapshotSeq = 0;
+    if (!c.loadColumnar("items.cat", &snapshotSeq)) {
+        ifstream test("items.bin", ios::binary);
+        if (test) {
+            test.close();
+            c.loadBinary("items.bin");
+        }
+    }
+
+    //Replay changes made after the snapshot, then log every further change
+    Journal journal;
+    size_t replayed = 0;
+    journal.open("items.cat.wal", snapshotSeq, [&](uint64_t, string_view rec) { replayed += c.applyJournalRecord(rec); });
+    if (replayed) cout << "Recovered " << replayed << " change(s) from items.cat.wal\n";
+    c.publish();
+    c.setJournal(&journal);
+
+    //Bulk ingest: --ingest <records file or -> adds TYPE|name|price|field lines without the menu
+    if (argc == 3 && string(argv[1]) == "--ingest") {
+        ifstream fin;
+        istream* in = &cin;
+        if (string(argv[2]) != "-") {
+            fin.open(argv[2], ios::binary);
+            if (!fin) { cerr << "Cannot open " << argv[2] << "\n"; return 1; }
+            in = &fin;
+        }
+        c.setJournal(nullptr); //The snapshot written below covers the whole batch
+        IngestResult r = c.ingest(*in);
+        c.setJournal(&journal);
+        for (const auto& e : r.rejects) cerr << argv[2] << ":" << e.line << ": " << e.message << ", record rejected\n";
+        c.compactJournal("items.cat");
+        bool saved = journal.close();
+        cout << "Added " << r.added << " item(s), rejected " << r.rejects.size() << "\n";
+        if (!saved) cerr << "Could not save items.cat\n";
+        return saved ? 0 : 1;
+    }
+
+    //Groceries past their expiry date are dropped in the background, checked once a minute
+    ExpirySweeper sweeper(c, chrono::minutes(1));
+    //The journal's thread compacts into items.cat when the log is large or a minute old
+    journal.setCompactionHandler([&] { c.compactJournal("items.cat"); });
+
+    shared_ptr<IoJob> exporting; //items.bin export running in the background
+    bool journalWarned = false;
     while (true) {
+        if (exporting && exporting->ready()) {
+            cout << (exporting->wait() ? "\nExport to items.bin finished\n" : "\nExport to items.bin failed\n");
+            exporting.reset();
+        }
+        if (size_t expired = sweeper.takeEvicted()) cout << "\nRemoved " << expired << " expired grocery item(s)\n";
         cout << "\nMenu:\n"; //Menu display
-        cout << "1. Add Grocery\n2. Add Electronics\n3. Add Clothing\n4. Add Book\n5. Add Toy\n6. Show All\n7. Save & Exit\nChoice: ";
+        cout << "1. Add Grocery\n2. Add Electronics\n3. Add Clothing\n4. Add Book\n5. Add Toy\n6. Show All\n7. Save & Exit\n8. Export items.bin\nChoice: ";
         int choice;
-        cin >> choice;
-
-        if (choice == 7) break;
+        if (!(cin >> choice) || choice == 7) break; //End of input saves as well
 
         string name;
         double price;
@@ -208,64 +2451,72 @@ int main() {
             case 1: {
                 string expiry;
                 cout << "Enter name, price, expiry: ";
-                cin >> name >> price >> expiry;
-                c.add(make_unique<Grocery>(name, price, expiry));
+                if (cin >> name >> price >> expiry) c.emplace<Grocery>(name, price, expiry);
                 break;
             }
             case 2: {
                 int warranty;
                 cout << "Enter name, price, warranty years: ";
-                cin >> name >> price >> warranty;
-                c.add(make_unique<Electronics>(name, price, warranty));
+                if (cin >> name >> price >> warranty) c.emplace<Electronics>(name, price, warranty);
                 break;
             }
             case 3: {
                 string size;
                 cout << "Enter name, price, size: ";
-                cin >> name >> price >> size;
-                c.add(make_unique<Clothing>(name, price, size));
+                if (cin >> name >> price >> size) c.emplace<Clothing>(name, price, size);
                 break;
             }
             case 4: {
                 string author;
                 cout << "Enter name, price, author: ";
-                cin >> name >> price >> author;
-                c.add(make_unique<Book>(name, price, author));
+                if (cin >> name >> price >> author) c.emplace<Book>(name, price, author);
                 break;
             }
             case 5: {
                 int age;
                 cout << "Enter name, price, recommended age: ";
-                cin >> name >> price >> age;
-                c.add(make_unique<Toy>(name, price, age));
+                if (cin >> name >> price >> age) c.emplace<Toy>(name, price, age);
                 break;
             }
             case 6: {
                 // Show all items
                 cout << "\n=== All Items ===\n";
-                c.showAll();
+                c.snapshot()->showAll();
 
-                // Show priority queue (descending price)
+                // Show items by descending price, taken from the price index and printed without the lock
                 cout << "\n=== Priority Queue (by descending price) ===\n";
-                auto cmp = [](Item* a, Item* b) { return *a < *b; };
-                priority_queue<Item*, vector<Item*>, decltype(cmp)> pq(cmp);
-
-                for (auto& item : c.getItems()) pq.push(item.get());
-
-                while (!pq.empty()) {
-                    pq.top()->display();
-                    pq.pop();
+                c.select([](const Container& all, auto emit) { all.topByPrice(all.size(), emit); })->showAll();
+                break;
+            }
+            case 8: {
+                if (exporting) {
+                    cout << "Export still running, " << (int)(exporting->progress() * 100) << "% done\n";
+                } else {
+                    exporting = c.saveBinaryAsync("items.bin");
+                    cout << "Exporting " << c.size() << " item(s) to items.bin in the background\n";
                 }
                 break;
             }
             default:
                 cout << "Invalid choice!\n";
         }
+        if (!cin) break; //A half-read item was never added, so never logged
+        c.publish();
+        if (journal.failed() && !journalWarned) cerr << "Cannot write items.cat.wal, changes are only saved on exit\n";
+        journalWarned = journal.failed();
     }
 
-    //Save everything back to file
-    c.saveBinary("items.bin");
+    //Save everything back to file and empty the journal
+    sweeper.stop();
+    journal.setCompactionHandler(nullptr);
+    if (exporting && !exporting->wait()) cout << "Export to items.bin failed\n";
+    c.compactJournal("items.cat");
+    if (!journal.close()) {
+        cerr << "\nCould not save items.cat, changes since the last save may be lost\n";
+        return 1;
+    }
     cout << "\nItems saved successfully!\n";
 
     return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -0,0 +1,57 @@
+#ifndef SNAPSHOT_CELL_H
+#define SNAPSHOT_CELL_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+//Holds a shared_ptr<const T> that any number of threads load while one at a time
+//replaces it. std::atomic_load on a shared_ptr is not lock-free in libstdc++ (it
+//goes through a small pool of mutexes), so this uses a two-phase read-copy-update
+//scheme instead: the pointer sits in a heap holder, a reader announces itself on
+//the counter of the current phase, copies the shared_ptr out of the holder and
+//leaves. store() swaps the holder, flips the phase and frees the old holder once
+//the readers of the previous phase are gone. Readers never block; store() waits
+//for at most the few instructions of the reads in flight.
+template <class T> class SnapshotCell {
+    struct Holder { std::shared_ptr<const T> value; };
+    std::atomic<Holder*> current;
+    std::atomic<unsigned> phase{ 0 };
+    mutable std::atomic<std::size_t> readers[2];
+    std::mutex writers;
+
+public:
+    explicit SnapshotCell(std::shared_ptr<const T> v = std::make_shared<const T>()) : current(new Holder{ std::move(v) }) {
+        readers[0].store(0);
+        readers[1].store(0);
+    }
+    SnapshotCell(const SnapshotCell&) = delete;
+    SnapshotCell& operator=(const SnapshotCell&) = delete;
+    ~SnapshotCell() { delete current.load(); }
+
+    std::shared_ptr<const T> load() const {
+        unsigned p;
+        while (true) { //Retried only when a store() flips the phase in between
+            p = phase.load();
+            readers[p & 1].fetch_add(1);
+            if (phase.load() == p) break;
+            readers[p & 1].fetch_sub(1);
+        }
+        std::shared_ptr<const T> v = current.load()->value;
+        readers[p & 1].fetch_sub(1);
+        return v;
+    }
+    void store(std::shared_ptr<const T> v) {
+        Holder* next = new Holder{ std::move(v) };
+        std::lock_guard<std::mutex> lock(writers);
+        Holder* old = current.exchange(next);
+        unsigned p = phase.load();
+        phase.store(p + 1); //Readers from here on can only see next
+        while (readers[p & 1].load() != 0) std::this_thread::yield();
+        delete old;
+    }
+};
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef STRING_POOL_H
+#define STRING_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+
+//Deduplicated string table. intern() hands out a 32-bit id per distinct string,
+//id 0 is the empty string. Interning takes a lock, view() does not: entries live
+//in fixed-size blocks that never move once published, and a string's bytes are
+//never freed while the pool exists.
+class StringPool {
+    static constexpr std::uint32_t BLOCK_BITS = 16;
+    static constexpr std::uint32_t BLOCK_SIZE = 1u << BLOCK_BITS;
+    static constexpr std::uint32_t MAX_BLOCKS = 1u << (32 - BLOCK_BITS);
+    std::unique_ptr<std::atomic<std::string_view*>[]> blocks;
+    std::uint32_t count = 0;
+    std::pmr::monotonic_buffer_resource chars; //Backing store for the string bytes
+    std::unordered_map<std::string_view, std::uint32_t> ids;
+    std::mutex m;
+
+public:
+    StringPool() : blocks(new std::atomic<std::string_view*>[MAX_BLOCKS]) {
+        for (std::uint32_t b = 0; b < MAX_BLOCKS; ++b) blocks[b].store(nullptr, std::memory_order_relaxed);
+        intern(std::string_view());
+    }
+    StringPool(const StringPool&) = delete;
+    StringPool& operator=(const StringPool&) = delete;
+    ~StringPool() {
+        for (std::uint32_t b = 0; b < MAX_BLOCKS; ++b) delete[] blocks[b].load(std::memory_order_relaxed);
+    }
+
+    std::uint32_t intern(std::string_view s) {
+        std::lock_guard<std::mutex> lock(m);
+        auto it = ids.find(s);
+        if (it != ids.end()) return it->second;
+        std::uint32_t id = count;
+        std::string_view* block = blocks[id >> BLOCK_BITS].load(std::memory_order_relaxed);
+        if (!block) {
+            block = new std::string_view[BLOCK_SIZE];
+            blocks[id >> BLOCK_BITS].store(block, std::memory_order_release);
+        }
+        char* p = (char*)chars.allocate(std::max<std::size_t>(s.size(), 1), 1);
+        if (!s.empty()) std::memcpy(p, s.data(), s.size());
+        block[id & (BLOCK_SIZE - 1)] = std::string_view(p, s.size());
+        ids.emplace(block[id & (BLOCK_SIZE - 1)], id);
+        ++count;
+        return id;
+    }
+    bool find(std::string_view s, std::uint32_t& id) { //Like intern() but never adds s
+        std::lock_guard<std::mutex> lock(m);
+        auto it = ids.find(s);
+        if (it == ids.end()) return false;
+        id = it->second;
+        return true;
+    }
+    //Only valid for ids returned by intern()
+    std::string_view view(std::uint32_t id) const {
+        return blocks[id >> BLOCK_BITS].load(std::memory_order_acquire)[id & (BLOCK_SIZE - 1)];
+    }
+    std::size_t size() {
+        std::lock_guard<std::mutex> lock(m);
+        return count;
+    }
+
+    static StringPool& global() { //Shared by every InternedString
+        static StringPool pool;
+        return pool;
+    }
+};
+
+//Four-byte handle to a string in the global pool. Equal strings have equal
+//handles, so comparing two of them is an integer compare.
+class InternedString {
+    std::uint32_t id = 0;
+public:
+    InternedString() = default;
+    explicit InternedString(std::string_view s) : id(StringPool::global().intern(s)) {}
+    static InternedString fromId(std::uint32_t id) { InternedString s; s.id = id; return s; }
+    static bool lookup(std::string_view s, InternedString& out) { return StringPool::global().find(s, out.id); } //False if s was never interned
+
+    std::uint32_t handle() const { return id; }
+    std::string_view view() const { return StringPool::global().view(id); }
+    bool empty() const { return id == 0; }
+    bool operator==(InternedString o) const { return id == o.id; }
+    bool operator!=(InternedString o) const { return id != o.id; }
+};
+
+#endif
@@ -0,0 +1,88 @@
+//Background saves and loads of items.bin, shopping_items_updated.cpp. Built twice:
+//async_load_test writes through io_uring when the kernel offers it and
+//async_load_fallback_test has ASYNC_FILE_NO_IO_URING, so the pwrite() thread.
+#define SHOPPING_ITEMS_UPDATED_NO_MAIN
+#include "../shopping_items_updated.cpp"
+#include "check.h"
+
+#include <sstream>
+
+namespace {
+
+//Every item's display line, in container order
+string contents(const Container& c) {
+    ostringstream os;
+    {
+        OutputBuffer out(os, OutputBuffer::FLUSH_MANUAL);
+        for (const auto& i : c.getItems()) i->format(out);
+    }
+    return os.str();
+}
+
+//Enough items that a plain file fills more than one 4 MiB writer buffer
+void fill(Container& c, int n) {
+    for (int i = 0; i < n; ++i) {
+        double price = i % 977 + 0.25;
+        switch (i % 5) {
+        case 0: c.emplace<Grocery>("g" + to_string(i), price, i % 2 ? "2026-03-01" : "fresh"); break;
+        case 1: c.emplace<Electronics>("e" + to_string(i), price, i % 36); break;
+        case 2: c.emplace<Clothing>("c" + to_string(i), price, i % 3 ? "M" : "XL"); break;
+        case 3: c.emplace<Book>("b" + to_string(i), price, i % 4 ? "Austen" : "Tolstoy"); break;
+        default: c.emplace<Toy>("t" + to_string(i), price, i % 12); break;
+        }
+    }
+}
+
+void writerUsesTheExpectedBackend() {
+    AsyncFileWriter w;
+    CHECK(w.open("async_load_test.tmp"));
+#ifdef ASYNC_FILE_NO_IO_URING
+    CHECK(!w.usesIoUring());
+#else
+    printf("  io_uring %s\n", w.usesIoUring() ? "in use" : "not offered, pwrite fallback");
+#endif
+    CHECK(w.close());
+    remove("async_load_test.tmp");
+}
+
+//saveBinaryAsync() then loadBinaryAsync()/finishLoad() give back the same items, in both formats
+void asyncSaveAndLoadRoundTrip() {
+    Container c;
+    fill(c, 250000);
+    string before = contents(c);
+    for (BinaryFormat format : { BinaryFormat::Plain, BinaryFormat::Compressed }) {
+        auto saved = c.saveBinaryAsync("async_load_test.bin", format);
+        CHECK(saved->wait());
+        CHECK(saved->completed() == c.size());
+
+        Container loaded;
+        loaded.emplace<Toy>("replaced", 1.0, 3);
+        auto l = loaded.loadBinaryAsync("async_load_test.bin");
+        while (!loaded.finishLoad(*l)) this_thread::yield();
+        CHECK(l->job.wait());
+        CHECK(l->job.completed() == c.size());
+        CHECK(contents(loaded) == before);
+        CHECK(loaded.findByName("e1") && loaded.findByName("e1")->getPrice() == 1.25);
+    }
+    remove("async_load_test.bin");
+}
+
+//A load that fails leaves the container as it was
+void failedLoadKeepsContents() {
+    Container c;
+    fill(c, 10);
+    string before = contents(c);
+    auto l = c.loadBinaryAsync("async_load_test.missing");
+    while (!c.finishLoad(*l)) this_thread::yield();
+    CHECK(!l->job.wait());
+    CHECK(contents(c) == before);
+}
+
+}
+
+int main() {
+    RUN_TEST(writerUsesTheExpectedBackend);
+    RUN_TEST(asyncSaveAndLoadRoundTrip);
+    RUN_TEST(failedLoadKeepsContents);
+    return checkResult();
+}
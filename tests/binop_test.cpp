@@ -0,0 +1,214 @@
+//BatchEvaluator against BinOp, the chunked pipeline and Formula, binOp2.cpp
+#define BINOP2_NO_MAIN
+#include "../binOp2.cpp"
+#include "check.h"
+
+#include <cmath>
+#include <random>
+#include <sstream>
+
+namespace {
+
+//Same value down to the sign of zero, any NaN matches any NaN
+bool same(double x, double y) {
+    if (std::isnan(x) || std::isnan(y)) return std::isnan(x) && std::isnan(y);
+    return std::memcmp(&x, &y, sizeof(x)) == 0;
+}
+
+//What BinOp::evaluate makes of one row, as the batch reports it
+unsigned char scalarEvaluate(double a, char op, double b, double& result) {
+    try {
+        result = BinOp(a, op, b).evaluate();
+        return EVAL_OK;
+    } catch (const std::runtime_error& e) {
+        result = std::numeric_limits<double>::quiet_NaN();
+        return std::string(e.what()) == "Division by zero" ? EVAL_DIVISION_BY_ZERO : EVAL_INVALID_OPERATOR;
+    }
+}
+
+//Checks every row of a batch against BinOp, returns the rows that differ
+std::size_t mismatches(const std::vector<double>& a, const std::vector<char>& ops, const std::vector<double>& b) {
+    std::size_t n = a.size(), bad = 0;
+    std::vector<double> results(n);
+    std::vector<unsigned char> status(n, 0xFF);
+    BatchEvaluator::evaluate(a.data(), ops.data(), b.data(), results.data(), status.data(), n);
+    for (std::size_t i = 0; i < n; ++i) {
+        double expected;
+        unsigned char st = scalarEvaluate(a[i], ops[i], b[i], expected);
+        if (status[i] != st || !same(results[i], expected)) ++bad;
+    }
+    return bad;
+}
+
+//Operands with zeros of both signs, so divisions by zero and -0.0 results turn up
+double randomOperand(std::mt19937& rng) {
+    static const double special[] = { 0.0, -0.0, 1.0, -1.0, 1e308, -1e308, 5e-324, HUGE_VAL };
+    if (rng() % 4 == 0) return special[rng() % 8];
+    return std::uniform_real_distribution<double>(-1000.0, 1000.0)(rng);
+}
+
+//Mixed operators, bad ones included, over several blocks and a tail that is not a
+//multiple of any vector width
+void batchMatchesBinOp() {
+    std::mt19937 rng(2024);
+    const char opChars[] = { '+', '-', '*', '/', '/', '%' };
+    const std::size_t n = 3 * 4096 + 7;
+    std::vector<double> a(n), b(n);
+    std::vector<char> ops(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        a[i] = randomOperand(rng);
+        b[i] = randomOperand(rng);
+        ops[i] = opChars[rng() % 6];
+    }
+    CHECK(mismatches(a, ops, b) == 0);
+
+    //Blocks with a single operator skip the grouping
+    for (char op : { '+', '-', '*', '/' }) {
+        std::fill(ops.begin(), ops.end(), op);
+        CHECK(mismatches(a, ops, b) == 0);
+    }
+
+    //Short batches stay in the scalar tail of the kernels
+    for (std::size_t m = 0; m < 8; ++m) {
+        std::vector<double> sa(a.begin(), a.begin() + m), sb(b.begin(), b.begin() + m);
+        std::vector<char> so(m, '/');
+        CHECK(mismatches(sa, so, sb) == 0);
+    }
+}
+
+//Signed zeros and division by zero row by row
+void zerosAndDivisionByZero() {
+    std::vector<double> a = { -0.0, 0.0, -0.0, 1.0, 0.0, -0.0, 3.0 };
+    std::vector<char> ops = { '+', '-', '*', '/', '/', '-', '/' };
+    std::vector<double> b = { -0.0, 0.0, 5.0, -0.0, 0.0, 0.0, -2.0 };
+    std::vector<double> r(a.size());
+    std::vector<unsigned char> st(a.size());
+    BatchEvaluator::evaluate(a.data(), ops.data(), b.data(), r.data(), st.data(), a.size());
+    CHECK(same(r[0], -0.0) && same(r[1], 0.0) && same(r[2], -0.0) && same(r[5], -0.0));
+    CHECK(st[3] == EVAL_DIVISION_BY_ZERO && st[4] == EVAL_DIVISION_BY_ZERO && std::isnan(r[3]) && std::isnan(r[4]));
+    CHECK(st[6] == EVAL_OK && r[6] == -1.5);
+    CHECK(mismatches(a, ops, b) == 0);
+}
+
+//Several MiB of expressions with bad lines mixed in come back one output line per
+//input line, in input order, with the errors where the bad lines were
+void pipelineKeepsLineOrder() {
+    const char opChars[] = { '+', '-', '*', '/' };
+    std::string input, expected;
+    std::size_t lines = 0, errors = 0;
+    for (int i = 0; input.size() < (3u << 20); ++i, ++lines) {
+        if (i % 97 == 13) { //Not an expression
+            input += "twelve plus " + std::to_string(i) + "\n";
+            expected += "Error evaluating expression: Invalid input\n";
+            ++errors;
+            continue;
+        }
+        double a = i + 0.25, b = i % 7, r;
+        char op = opChars[i % 4];
+        input += std::to_string(i) + ".25 " + op + " " + std::to_string(i % 7) + "\n";
+        unsigned char st = scalarEvaluate(a, op, b, r);
+        errors += st != EVAL_OK;
+        appendResult(expected, a, op, b, r, st);
+    }
+    std::istringstream in(input);
+    std::ostringstream out;
+    PipelineStats stats = runPipeline(in, out, 4);
+    CHECK(stats.rows == lines);
+    CHECK(stats.errors == errors);
+    std::string got = out.str();
+    CHECK((std::size_t)std::count(got.begin(), got.end(), '\n') == lines);
+    CHECK(got == expected);
+}
+
+//Value of a formula with no variables, NaN when it does not compile
+double value(const std::string& text, unsigned char* status = nullptr) {
+    Formula f;
+    return f.compile(text) && f.names().empty() ? f.evaluate(nullptr, status) : std::numeric_limits<double>::quiet_NaN();
+}
+std::string compileError(const std::string& text) {
+    Formula f;
+    std::string error;
+    return f.compile(text, &error) ? std::string() : error;
+}
+std::string nested(int levels, const std::string& innermost) { //1+(1+(...innermost...))
+    std::string s = innermost;
+    for (int i = 0; i < levels; ++i) s = "1+(" + s + ")";
+    return s;
+}
+
+//Precedence, associativity, unary minus and folded constants
+void formulaFollowsPrecedence() {
+    CHECK(value("2 + 3 * 4") == 14);
+    CHECK(value("(2 + 3) * 4") == 20);
+    CHECK(value("10 - 4 - 3") == 3);
+    CHECK(value("8 / 4 / 2") == 1);
+    CHECK(value("-2 * -3") == 6);
+    CHECK(value("-3 - -3") == 0);
+    CHECK(value("--2 + +2") == 4);
+    CHECK(value("-(2 + 3) * 2") == -10);
+    CHECK(value(nested(50, "1")) == 51);
+
+    unsigned char st = EVAL_OK;
+    CHECK(std::isnan(value("1 + 1 / 0", &st)) && st == EVAL_DIVISION_BY_ZERO); //Not folded away
+    CHECK(value("1 / 2 * 0", &st) == 0 && st == EVAL_OK);
+
+    Formula f;
+    CHECK(f.compile("b - a * b + -(a) * (2 * 3)"));
+    CHECK(f.names() == std::vector<std::string>({ "b", "a" })); //Order of first use
+    double v[] = { 4.0, 0.5 };
+    CHECK(f.evaluate(v) == 4.0 - 0.5 * 4.0 - 0.5 * 6.0);
+}
+
+//Errors name the problem and the column, and deep nesting is refused rather than overflowing
+void formulaReportsErrors() {
+    CHECK(compileError("x + * y") == "expected a number, name or '(' at column 5");
+    CHECK(compileError("(x + 1") == "expected ')' at column 7");
+    CHECK(compileError("x y") == "unexpected character at column 3");
+    CHECK(compileError("") == "expected a number, name or '(' at column 1");
+    CHECK(compileError("x / ") == "expected a number, name or '(' at column 5");
+    CHECK(compileError(nested(50, "x")).empty());
+    CHECK(compileError(nested(70, "x")).compare(0, 25, "formula nests too deeply ") == 0); //Operand stack
+    CHECK(compileError(std::string(300, '(') + "x" + std::string(300, ')')) == "formula nests too deeply at column 257");
+    Formula f;
+    CHECK(f.compile("x + 1") && !f.compile("x +") && f.empty()); //A failed compile leaves nothing behind
+}
+
+//Whole columns give what row by row evaluation gives, zero divisors included
+void formulaColumnsMatchRows() {
+    std::mt19937 rng(7);
+    const std::size_t n = 2 * 4096 + 13;
+    for (const char* text : { "price * (1 + tax) - discount / 2", "-price / tax + -(discount - price) * 2", "3 / tax", "price" }) {
+        Formula f;
+        CHECK(f.compile(text));
+        std::size_t vars = f.names().size();
+        std::vector<std::vector<double>> columns(vars, std::vector<double>(n));
+        for (auto& c : columns)
+            for (double& x : c) x = rng() % 5 == 0 ? 0.0 : randomOperand(rng);
+        std::vector<const double*> bindings;
+        for (auto& c : columns) bindings.push_back(c.data());
+        std::vector<double> results(n);
+        std::vector<unsigned char> status(n);
+        f.evaluate(bindings.data(), results.data(), status.data(), n);
+        std::size_t bad = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            double row[8];
+            for (std::size_t v = 0; v < vars; ++v) row[v] = columns[v][i];
+            unsigned char st;
+            double r = f.evaluate(row, &st);
+            if (st != status[i] || (st == EVAL_OK && !same(r, results[i]))) ++bad;
+        }
+        CHECK(bad == 0);
+    }
+}
+
+}
+
+int main() {
+    RUN_TEST(batchMatchesBinOp);
+    RUN_TEST(zerosAndDivisionByZero);
+    RUN_TEST(pipelineKeepsLineOrder);
+    RUN_TEST(formulaFollowsPrecedence);
+    RUN_TEST(formulaReportsErrors);
+    RUN_TEST(formulaColumnsMatchRows);
+    return checkResult();
+}
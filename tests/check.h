@@ -0,0 +1,24 @@
+#ifndef TESTS_CHECK_H
+#define TESTS_CHECK_H
+
+#include <cstdio>
+
+//Checks that stay on in release builds, unlike assert(). A failed CHECK prints
+//where it was and the test carries on, so one run reports every failure.
+inline int& checkFailures() {
+    static int failures = 0;
+    return failures;
+}
+#define CHECK(cond) \
+    ((cond) ? (void)0 : (std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond), (void)++checkFailures()))
+
+//Runs one test function and names it in the output
+#define RUN_TEST(test) (std::printf("%s\n", #test), test())
+
+//Exit code for main: 0 when every check passed
+inline int checkResult() {
+    if (checkFailures()) std::fprintf(stderr, "%d check(s) failed\n", checkFailures());
+    return checkFailures() ? 1 : 0;
+}
+
+#endif
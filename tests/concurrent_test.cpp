@@ -0,0 +1,133 @@
+//SnapshotCell and ConcurrentContainer under concurrent readers and writers, shopping_items_updated.cpp
+#define SHOPPING_ITEMS_UPDATED_NO_MAIN
+#include "../shopping_items_updated.cpp"
+#include "check.h"
+
+#include <sstream>
+
+namespace {
+
+const int READERS = 4;
+
+//Readers of a cell only ever see values that were stored, in store order
+void snapshotCellReadsAreOrdered() {
+    SnapshotCell<int> cell(make_shared<const int>(0));
+    atomic<bool> done{ false };
+    atomic<int> bad{ 0 };
+    vector<thread> readers;
+    for (int r = 0; r < READERS; ++r)
+        readers.emplace_back([&] {
+            int last = 0;
+            while (!done) {
+                int v = *cell.load();
+                if (v < last) ++bad;
+                last = v;
+            }
+        });
+    for (int i = 1; i <= 100000; ++i) cell.store(make_shared<const int>(i));
+    done = true;
+    for (auto& t : readers) t.join();
+    CHECK(bad == 0);
+    CHECK(*cell.load() == 100000);
+}
+
+//Item whose name says its price, so a reader can tell a live item from freed memory
+void addNamed(ConcurrentContainer& c, int n) {
+    if (n % 2) c.emplace<Grocery>("g" + to_string(n), (double)n, n % 4 == 1 ? "2020-01-01" : "2999-01-01");
+    else c.emplace<Toy>("t" + to_string(n), (double)n, 3);
+}
+bool intact(const Item& i) {
+    string_view name = i.getName();
+    return name.size() > 1 && name.substr(1) == to_string((int)i.getPrice());
+}
+
+//Readers walk whole snapshots while a writer appends, removes, evicts and reloads.
+//Every snapshot must stay readable for as long as it is held.
+void readersSeeIntactSnapshots() {
+    {
+        ConcurrentContainer seed;
+        for (int n = 0; n < 3000; ++n) addNamed(seed, n);
+        seed.publish();
+        CHECK(seed.saveBinaryAsync("concurrent_test.bin")->wait());
+    }
+    ConcurrentContainer c(64);
+    atomic<bool> done{ false };
+    atomic<long> snapshots{ 0 }, broken{ 0 };
+    vector<thread> readers;
+    for (int r = 0; r < READERS; ++r)
+        readers.emplace_back([&] {
+            while (!done) {
+                auto s = c.snapshot();
+                size_t ok = 0;
+                s->forEach([&](const Item& i) { ok += intact(i); });
+                if (ok != s->size()) ++broken;
+                ++snapshots;
+            }
+        });
+
+    for (int round = 0; round < 20; ++round) {
+        for (int n = 0; n < 500; ++n) addNamed(c, round * 1000 + n);
+        for (int n = 0; n < 50; ++n) c.remove((size_t)(n * 7) % c.query([](const Container& all) { return all.size(); }));
+        c.evictExpired(Date(2021, 1, 1));
+        if (round % 5 == 4) CHECK(c.loadBinary("concurrent_test.bin"));
+    }
+    c.publish();
+    done = true;
+    for (auto& t : readers) t.join();
+    CHECK(broken == 0);
+    CHECK(snapshots > 0);
+
+    //After publish() the snapshot lists exactly the latest contents
+    auto s = c.snapshot();
+    bool same = c.query([&](const Container& all) {
+        if (all.size() != s->size()) return false;
+        for (size_t k = 0; k < all.size(); ++k) if (all.getItems()[k].get() != &(*s)[k]) return false;
+        return true;
+    });
+    CHECK(same);
+    remove("concurrent_test.bin");
+}
+
+//Appends become visible in batches, bulk changes at once
+void publishingFollowsBatches() {
+    ConcurrentContainer c(3);
+    auto empty = c.snapshot();
+    addNamed(c, 2);
+    addNamed(c, 4);
+    CHECK(c.size() == 0);
+    addNamed(c, 6);
+    CHECK(c.size() == 3);
+    addNamed(c, 1); //Expired grocery
+    CHECK(c.size() == 3);
+    c.publish();
+    CHECK(c.size() == 4);
+    CHECK(c.evictExpired(Date(2021, 1, 1)) == 1);
+    CHECK(c.size() == 3);
+    istringstream in("Toy|x|1|3\nToy|y|nan|3\n");
+    IngestResult r = c.ingest(in);
+    CHECK(r.added == 1 && r.rejects.size() == 1 && c.size() == 4);
+    CHECK(empty->size() == 0); //Old snapshots never change
+}
+
+//select() hands back the query's items in its order, and they outlive the catalog's copies
+void selectedItemsOutliveChanges() {
+    ConcurrentContainer c;
+    for (int n : { 5, 2, 8, 3 }) c.emplace<Toy>("t" + to_string(n), (double)n, 3);
+    auto top = c.select([](const Container& all, auto emit) { all.topByPrice(3, emit); });
+    for (int k = 0; k < 4; ++k) c.remove(0);
+    CHECK(c.query([](const Container& all) { return all.size(); }) == 0);
+    CHECK(top->size() == 3);
+    string names;
+    top->forEach([&](const Item& i) { names += string(i.getName()) + " "; CHECK(intact(i)); });
+    CHECK(names == "t8 t5 t3 ");
+}
+
+}
+
+int main() {
+    RUN_TEST(snapshotCellReadsAreOrdered);
+    RUN_TEST(readersSeeIntactSnapshots);
+    RUN_TEST(publishingFollowsBatches);
+    RUN_TEST(selectedItemsOutliveChanges);
+    return checkResult();
+}
@@ -0,0 +1,446 @@
+//Container, its indexes and the file formats, shopping_items_updated.cpp
+#define SHOPPING_ITEMS_UPDATED_NO_MAIN
+#include "../shopping_items_updated.cpp"
+#include "check.h"
+
+#include <sstream>
+
+namespace {
+
+//Names in the order a price query hands the items out
+template <class Query> string names(Query query) {
+    string out;
+    query([&](const Item& i) { out += (out.empty() ? "" : " ") + string(i.getName()); });
+    return out;
+}
+
+//A NaN price used to break the treap: listings stopped early, removing the item
+//left a dangling node behind and a bulk rebuild sorted with an invalid order
+void nanPriceStaysInOrder() {
+    Container c;
+    c.emplace<Toy>("a", 5.0, 3);
+    c.emplace<Toy>("nan", NAN, 3);
+    c.emplace<Toy>("b", 7.0, 3);
+    c.emplace<Toy>("c", 1.0, 3);
+    CHECK(names([&](auto f) { c.topByPrice(c.size(), f); }) == "b a c nan");
+    CHECK(names([&](auto f) { c.inPriceRange(0.0, 10.0, f); }) == "b a c");
+    CHECK(c.priceRank(6.0) == 1);
+    CHECK(c.priceRank(NAN) == 3);
+    CHECK(c.nthMostExpensive(3)->getName() == "nan");
+
+    c.remove(1);
+    CHECK(c.size() == 3);
+    CHECK(names([&](auto f) { c.topByPrice(10, f); }) == "b a c");
+    CHECK(c.nthMostExpensive(2)->getName() == "c");
+    CHECK(c.nthMostExpensive(3) == nullptr);
+
+    //Bulk rebuild after a large ingest
+    Container bulk;
+    bulk.emplace<Toy>("nan", NAN, 3);
+    bulk.emplace<Toy>("nan2", NAN, 3);
+    istringstream in("Toy|a|5|3\nToy|b|7|3\nToy|c|1|3\n");
+    bulk.ingest(in);
+    CHECK(bulk.priceRank(6.0) == 1);
+    CHECK(names([&](auto f) { bulk.inPriceRange(-HUGE_VAL, HUGE_VAL, f); }) == "b a c");
+    CHECK(bulk.nthMostExpensive(0)->getName() == "b");
+    bulk.remove(0);
+    bulk.remove(1); //Both NaN items, c filled the first gap
+    CHECK(bulk.size() == 3);
+    CHECK(names([&](auto f) { bulk.topByPrice(10, f); }) == "b a c");
+}
+
+//Price queries against a sort of the same prices, with many ties
+void priceQueriesMatchSortedPrices() {
+    Container c;
+    vector<double> prices;
+    uint32_t r = 12345;
+    for (int i = 0; i < 500; ++i) {
+        r = r * 1103515245u + 12345u;
+        double p = (r >> 16) % 20; //Only 20 distinct prices
+        prices.push_back(p);
+        c.emplace<Toy>("t" + to_string(i), p, 3);
+    }
+    for (int i = 0; i < 100; ++i) c.remove((size_t)(i * 3) % c.size()); //Removals keep the index in step
+    prices.clear();
+    for (const auto& i : c.getItems()) prices.push_back(i->getPrice());
+    sort(prices.rbegin(), prices.rend());
+
+    for (double q : { -1.0, 0.0, 0.5, 7.0, 19.0, 25.0 }) {
+        size_t above = count_if(prices.begin(), prices.end(), [&](double p) { return p > q; });
+        CHECK(c.priceRank(q) == above); //Ties are not counted
+    }
+    for (size_t n = 0; n < prices.size(); ++n) CHECK(c.nthMostExpensive(n)->getPrice() == prices[n]);
+    CHECK(c.nthMostExpensive(prices.size()) == nullptr);
+    CHECK(c.nthMostExpensive(SIZE_MAX) == nullptr);
+
+    auto rangeCount = [&](double lo, double hi) {
+        size_t n = 0;
+        double last = HUGE_VAL;
+        bool ordered = true;
+        c.inPriceRange(lo, hi, [&](const Item& i) {
+            ordered = ordered && i.getPrice() <= last && i.getPrice() >= lo && i.getPrice() <= hi;
+            last = i.getPrice();
+            ++n;
+        });
+        CHECK(ordered);
+        return n;
+    };
+    CHECK(rangeCount(5.0, 5.0) == (size_t)count(prices.begin(), prices.end(), 5.0)); //One price, every tie
+    CHECK(rangeCount(3.0, 8.0) == (size_t)count_if(prices.begin(), prices.end(), [](double p) { return p >= 3.0 && p <= 8.0; }));
+    CHECK(rangeCount(5.2, 5.8) == 0); //Between two prices
+    CHECK(rangeCount(8.0, 3.0) == 0); //Inverted
+    CHECK(rangeCount(100.0, 200.0) == 0);
+    CHECK(rangeCount(-HUGE_VAL, HUGE_VAL) == prices.size());
+
+    string top;
+    c.topByPrice(3, [&](const Item& i) { top += to_string((int)i.getPrice()) + " "; });
+    CHECK(top == to_string((int)prices[0]) + " " + to_string((int)prices[1]) + " " + to_string((int)prices[2]) + " ");
+    size_t all = 0;
+    c.topByPrice(prices.size() + 10, [&](const Item&) { ++all; });
+    CHECK(all == prices.size());
+
+    Container empty;
+    CHECK(empty.priceRank(1.0) == 0);
+    CHECK(empty.nthMostExpensive(0) == nullptr);
+    CHECK(names([&](auto f) { empty.inPriceRange(-HUGE_VAL, HUGE_VAL, f); }).empty());
+}
+
+//Item names in container order
+string contents(const Container& c) {
+    string out;
+    for (const auto& i : c.getItems()) out += string(i->getName()) + ",";
+    return out;
+}
+
+//Eviction removes exactly the groceries before the cutoff, keeps every index in
+//step and journals swap-removes that replay to the same order
+void evictionMatchesScanAndReplays() {
+    remove("evict_test.wal");
+    Journal journal;
+    journal.open("evict_test.wal", 0, [](uint64_t, string_view) {});
+    Container c;
+    c.setJournal(&journal);
+    for (int i = 0; i < 12000; ++i) {
+        char date[11];
+        snprintf(date, sizeof(date), "2026-%02d-%02d", 1 + i % 12, 1 + i % 28);
+        if (i % 3 == 0) c.emplace<Book>("b" + to_string(i), i % 50, "Austen");
+        else c.emplace<Grocery>("g" + to_string(i), i % 50, i % 7 ? date : "soon");
+    }
+    c.remove(10);
+    c.remove(0);
+    c.update(5, make_unique<Grocery>("replaced", 1.0, "2026-01-02"));
+    c.add(make_unique<Grocery>("heap", 2.0, "2026-01-01"));
+
+    Date cutoff(2026, 7, 1);
+    auto expired = [&](const Item& i) {
+        if (i.kind() != ItemKind::Grocery) return false;
+        Date d = static_cast<const Grocery&>(i).getExpiryDate();
+        return d.valid() && d < cutoff;
+    };
+    size_t expected = 0;
+    for (const auto& i : c.getItems()) expected += expired(*i);
+    size_t before = c.size();
+    CHECK(c.evictExpired(cutoff) == expected);
+    CHECK(c.size() == before - expected);
+    size_t left = 0;
+    for (const auto& i : c.getItems()) left += expired(*i);
+    CHECK(left == 0);
+    CHECK(c.evictExpired(cutoff) == 0);
+    CHECK(c.findByName("heap") == nullptr && c.findByName("replaced") == nullptr);
+    size_t listed = 0;
+    c.topByPrice(c.size(), [&](const Item& i) { listed += !expired(i); });
+    CHECK(listed == c.size());
+
+    //Later groceries are still found, at their new positions
+    size_t later = 0;
+    for (const auto& i : c.getItems())
+        later += i->kind() == ItemKind::Grocery && static_cast<const Grocery&>(*i).getExpiryDate().valid();
+    CHECK(c.evictExpired(Date(2027, 1, 1)) == later);
+    c.remove(0);
+    CHECK(c.size() > 0);
+
+    string final = contents(c);
+    journal.close();
+    Container replayed;
+    size_t applied = 0, records = 0;
+    Journal again;
+    again.open("evict_test.wal", 0, [&](uint64_t, string_view rec) { ++records; applied += replayed.applyJournalRecord(rec); });
+    again.close();
+    CHECK(applied == records);
+    CHECK(contents(replayed) == final);
+    remove("evict_test.wal");
+}
+
+//remove() fills the gap with the last item, 'R' records from older logs still keep the order
+void removalsAndOldRecords() {
+    Container c;
+    for (const char* n : { "a", "b", "c", "d", "e" }) c.emplace<Grocery>(n, 1.0, "2026-01-0" + string(n[0] == 'e' ? "1" : "2"));
+    c.remove(1);
+    CHECK(contents(c) == "a,e,c,d,");
+    CHECK(names([&](auto f) { c.expiringBefore(Date(2026, 1, 2), f); }) == "e");
+    CHECK(c.evictExpired(Date(2026, 1, 2)) == 1 && contents(c) == "a,d,c,");
+    string rec = "R";
+    for (int b = 0; b < 8; ++b) rec.push_back(b ? '\0' : '\1'); //Index 1
+    CHECK(c.applyJournalRecord(rec));
+    CHECK(contents(c) == "a,c,");
+    CHECK(c.evictExpired(Date(2026, 1, 3)) == 2 && c.size() == 0);
+}
+
+//The struct-of-arrays store answers the bulk queries the same way a walk over the
+//Container it was filled from does, whether copied item by item or loaded from items.cat
+void itemStoreMatchesContainer() {
+    Container c;
+    for (int i = 0; i < 1000; ++i) {
+        double price = (i * 7919) % 1000 / 4.0;
+        switch (i % 5) {
+            case 0: c.emplace<Grocery>("g" + to_string(i), price, i % 2 ? "2026-03-01" : "fresh"); break;
+            case 1: c.emplace<Electronics>("e" + to_string(i), price, i % 4); break;
+            case 2: c.emplace<Clothing>("c" + to_string(i), price, i % 3 ? "M" : "XL"); break;
+            case 3: c.emplace<Book>("b" + to_string(i), price, "Orwell"); break;
+            default: c.emplace<Toy>("t" + to_string(i), price, i % 12); break;
+        }
+    }
+    c.remove(3);
+    c.saveColumnar("store_test.cat");
+    ItemStore copied, loaded;
+    for (const auto& i : c.getItems()) copied.add(*i);
+    CHECK(loaded.loadColumnar("store_test.cat"));
+    remove("store_test.cat");
+
+    double total = 0.0;
+    array<size_t, ITEM_KIND_COUNT> counts{};
+    for (const auto& i : c.getItems()) { total += i->getPrice(); ++counts[(int)i->kind()]; }
+    for (const ItemStore* s : { &copied, &loaded }) {
+        CHECK(s->size() == c.size());
+        CHECK(s->totalValue() == total); //Same items in the same order, so the same rounding
+        CHECK(s->countByType() == counts);
+        for (double lo : { 0.0, 50.0, 100.25, 300.0 })
+            for (double hi : { 49.75, 100.25, 250.0, 1000.0 }) {
+                vector<size_t> expected;
+                for (size_t k = 0; k < c.size(); ++k) {
+                    double p = c.getItems()[k]->getPrice();
+                    if (p >= lo && p <= hi) expected.push_back(k);
+                }
+                CHECK(s->filterByPrice(lo, hi) == expected);
+            }
+        bool same = true;
+        for (size_t k = 0; k < c.size(); ++k) {
+            ItemView a = s->view(k), b = viewOf(*c.getItems()[k]);
+            same = same && a.kind == b.kind && a.name == b.name && a.price == b.price && a.text == b.text && a.number == b.number;
+        }
+        CHECK(same);
+    }
+    ItemStore empty;
+    CHECK(empty.totalValue() == 0.0 && empty.filterByPrice(-HUGE_VAL, HUGE_VAL).empty());
+    CHECK(empty.countByType() == (array<size_t, ITEM_KIND_COUNT>{}));
+}
+
+//Name, author and size lookups follow adds, updates and removals
+void nameLookupsFollowChanges() {
+    Container c;
+    c.emplace<Book>("Dune", 9.0, "Herbert");
+    c.emplace<Book>("Dune Messiah", 8.0, "Herbert");
+    c.emplace<Book>("Emma", 5.0, "Austen");
+    c.emplace<Clothing>("Shirt", 20.0, "M");
+    c.emplace<Clothing>("Dungarees", 30.0, "M");
+    c.emplace<Toy>("Duck", 2.0, 1);
+    auto all = [&](auto query) { vector<string> out; query([&](const Item& i) { out.emplace_back(i.getName()); }); sort(out.begin(), out.end()); return out; };
+    typedef vector<string> Names;
+
+    CHECK(c.findByName("Emma") && c.findByName("Emma")->getPrice() == 5.0);
+    CHECK(c.findByName("emma") == nullptr);
+    CHECK(c.findByName("Dun") == nullptr); //Exact names only
+    CHECK(all([&](auto f) { c.booksByAuthor("Herbert", f); }) == Names({ "Dune", "Dune Messiah" }));
+    CHECK(all([&](auto f) { c.booksByAuthor("Tolkien", f); }).empty());
+    CHECK(all([&](auto f) { c.clothingBySize("M", f); }) == Names({ "Dungarees", "Shirt" }));
+    CHECK(all([&](auto f) { c.clothingBySize("XXL", f); }).empty());
+
+    Names prefixed;
+    c.autocomplete("Du", 10, [&](const Item& i) { prefixed.emplace_back(i.getName()); });
+    CHECK(prefixed == Names({ "Duck", "Dune", "Dune Messiah", "Dungarees" })); //In name order
+    prefixed.clear();
+    c.autocomplete("Du", 2, [&](const Item& i) { prefixed.emplace_back(i.getName()); });
+    CHECK(prefixed == Names({ "Duck", "Dune" }));
+    CHECK(all([&](auto f) { c.autocomplete("Dune", 10, f); }) == Names({ "Dune", "Dune Messiah" }));
+    CHECK(all([&](auto f) { c.autocomplete("X", 10, f); }).empty());
+    CHECK(all([&](auto f) { c.autocomplete("", 10, f); }).size() == 6);
+
+    c.remove(0); //Dune, Duck moves to its place
+    CHECK(c.findByName("Dune") == nullptr);
+    CHECK(all([&](auto f) { c.booksByAuthor("Herbert", f); }) == Names({ "Dune Messiah" }));
+    CHECK(all([&](auto f) { c.autocomplete("Dune", 10, f); }) == Names({ "Dune Messiah" }));
+    c.update(3, make_unique<Clothing>("Shirt", 25.0, "L")); //Same name, new size
+    CHECK(c.findByName("Shirt")->getPrice() == 25.0);
+    CHECK(all([&](auto f) { c.clothingBySize("M", f); }) == Names({ "Dungarees" }));
+    CHECK(all([&](auto f) { c.clothingBySize("L", f); }) == Names({ "Shirt" }));
+    c.update(1, make_unique<Toy>("Kite", 4.0, 6)); //Dune Messiah becomes a Toy
+    CHECK(all([&](auto f) { c.booksByAuthor("Herbert", f); }).empty());
+    CHECK(c.findByName("Kite") && c.findByName("Dune Messiah") == nullptr);
+
+    c.emplace<Toy>("Duck", 3.0, 2); //Duplicate names are all kept
+    CHECK(all([&](auto f) { c.forEachByName("Duck", f); }).size() == 2);
+    c.remove(c.size() - 1);
+    CHECK(all([&](auto f) { c.forEachByName("Duck", f); }).size() == 1);
+    CHECK(c.findByName("Duck")->getPrice() == 2.0);
+}
+
+//The external sort keeps file string tables to itself: sorting files whose strings
+//were never interned leaves the global StringPool as it was
+void externalSortLeavesStringPoolAlone() {
+    {
+        ofstream legacy("sort_test_in.bin", ios::binary); //Old format, text fields inline
+        auto putString = [&](string_view v) { size_t n = v.size(); legacy.write((char*)&n, sizeof(n)); legacy.write(v.data(), n); };
+        for (int i = 0; i < 2000; ++i) {
+            double price = (i * 37) % 101;
+            putString("Book");
+            putString("sort-book-" + to_string(i));
+            legacy.write((char*)&price, sizeof(price));
+            putString("sort-author-" + to_string(i % 300));
+        }
+    }
+    size_t pooled = StringPool::global().size();
+    ExternalSortOptions opt;
+    opt.memoryBudget = 1 << 20; //Several runs
+    ExternalSort byPrice(opt);
+    CHECK(byPrice.sortFile("sort_test_in.bin", "sort_test_price.bin"));
+    CHECK(byPrice.size() == 2000);
+    opt.key = SortKey::Name;
+    ExternalSort byName(opt);
+    CHECK(byName.sortFile("sort_test_price.bin", "sort_test_name.bin")); //Interned input this time
+    CHECK(StringPool::global().size() == pooled);
+
+    CatalogView sorted;
+    CHECK(sorted.open("sort_test_price.bin") && sorted.complete() && sorted.size() == 2000);
+    bool ordered = true, fieldsKept = true;
+    for (size_t i = 0; i < sorted.size(); ++i) {
+        ItemView v = sorted[i];
+        if (i && sorted[i - 1].price < v.price) ordered = false;
+        int n = atoi(v.name.data() + 10); //After "sort-book-"
+        if (v.text != "sort-author-" + to_string(n % 300) || v.price != (n * 37) % 101) fieldsKept = false;
+    }
+    CHECK(ordered && fieldsKept);
+    CatalogView named;
+    CHECK(named.open("sort_test_name.bin") && named.size() == 2000);
+    for (size_t i = 1; i < named.size(); ++i) if (named[i - 1].name > named[i].name) ordered = false;
+    CHECK(ordered);
+    CHECK(StringPool::global().size() == pooled);
+    for (const char* f : { "sort_test_in.bin", "sort_test_price.bin", "sort_test_name.bin" }) remove(f);
+}
+
+string fileBytes(const string& file) {
+    ifstream in(file, ios::binary);
+    return string(istreambuf_iterator<char>(in), {});
+}
+
+//--repack turns a plain items.bin into compressed blocks and back without changing a byte
+void repackRoundTrips() {
+    Container c;
+    for (int i = 0; i < 20000; ++i) {
+        if (i % 3 == 0) c.emplace<Book>("b" + to_string(i), i % 50, i % 2 ? "Austen" : "Tolstoy");
+        else if (i % 3 == 1) c.emplace<Grocery>("g" + to_string(i), i % 40 + 0.5, "2026-03-01");
+        else c.emplace<Electronics>("e" + to_string(i), i % 90, i % 5);
+    }
+    CHECK(c.saveBinary("repack_plain.bin"));
+    CHECK(repackBinary("repack_plain.bin", "repack_packed.bin", BinaryFormat::Compressed));
+    string plain = fileBytes("repack_plain.bin"), packed = fileBytes("repack_packed.bin");
+    CHECK(CompressedCatalog::detect(packed.data(), packed.size()));
+    CHECK(packed.size() < plain.size() / 2);
+
+    CatalogView a, b;
+    CHECK(a.open("repack_plain.bin") && b.open("repack_packed.bin") && a.size() == b.size() && b.size() == c.size());
+    bool same = true;
+    for (size_t k = 0; k < a.size(); ++k) {
+        ItemView x = a[k], y = b[k];
+        same = same && x.kind == y.kind && x.name == y.name && x.price == y.price && x.text == y.text && x.number == y.number;
+    }
+    CHECK(same);
+    Container loaded;
+    loaded.loadBinary("repack_packed.bin");
+    CHECK(contents(loaded) == contents(c));
+
+    CHECK(repackBinary("repack_packed.bin", "repack_packed.bin", BinaryFormat::Plain)); //In place
+    CHECK(fileBytes("repack_packed.bin") == plain);
+    CHECK(!repackBinary("repack_missing.bin", "repack_out.bin", BinaryFormat::Compressed));
+    for (const char* f : { "repack_plain.bin", "repack_packed.bin", "repack_out.bin" }) remove(f);
+}
+
+//The items.txt parser turns non-finite prices away
+void textRecordsRejectNonFinitePrices() {
+    ItemView v;
+    string error;
+    CHECK(parseTextRecord("Toy|a|5.5|3", v, &error) && v.price == 5.5);
+    for (const char* line : { "Toy|a|nan|3", "Toy|a|inf|3", "Toy|a|-inf|3", "Toy|a|NaN|3" }) {
+        CHECK(!parseTextRecord(line, v, &error));
+        CHECK(error.compare(0, 9, "bad price") == 0);
+    }
+    Container c;
+    istringstream in("Toy|a|nan|3\nToy|b|2|3\n");
+    IngestResult r = c.ingest(in);
+    CHECK(r.added == 1 && r.rejects.size() == 1 && r.rejects[0].line == 1);
+}
+
+//ReportEngine's per-type counts and sums, histogram and warranty buckets, on a few
+//items worked out by hand and then on enough items to split across the pool
+void reportGroupsByType() {
+    WorkerPool pool(4);
+    Container c;
+    c.emplace<Grocery>("milk", 1.5, "2026-01-10");
+    c.emplace<Grocery>("bread", 2.25, "fresh");
+    c.emplace<Electronics>("radio", 120.0, 2);
+    c.emplace<Electronics>("tv", 899.75, 9);
+    c.emplace<Electronics>("cable", 4.0, 0);
+    c.emplace<Book>("novel", 12.5, "Austen");
+    c.emplace<Toy>("kite", 1500.0, 8);
+    ItemStore store;
+    for (const auto& i : c.getItems()) store.add(*i);
+    ReportOptions opt;
+    opt.expiryBefore = "2026-02-01";
+    CatalogReport r = ReportEngine(pool).run(store, opt);
+    const auto& by = r.byType;
+    CHECK(by[(int)ItemKind::Grocery].count == 2 && by[(int)ItemKind::Grocery].total == 3.75);
+    CHECK(by[(int)ItemKind::Electronics].count == 3 && by[(int)ItemKind::Electronics].total == 1023.75);
+    CHECK(by[(int)ItemKind::Clothing].count == 0 && by[(int)ItemKind::Clothing].average() == 0.0);
+    CHECK(by[(int)ItemKind::Book].count == 1 && by[(int)ItemKind::Book].total == 12.5);
+    CHECK(by[(int)ItemKind::Toy].count == 1 && by[(int)ItemKind::Toy].average() == 1500.0);
+    CHECK(r.priceHistogram == vector<size_t>({ 4, 1, 0, 0, 0, 0, 0, 0, 1, 0 }) && r.aboveHistogram == 1 && r.belowHistogram == 0);
+    CHECK(r.electronicsByWarranty == vector<size_t>({ 1, 0, 1, 0, 0, 1 }));
+    CHECK(r.groceriesExpiringBefore == 1);
+
+    Container big;
+    array<CatalogReport::TypeTotals, ITEM_KIND_COUNT> expected{};
+    for (int i = 0; i < 20000; ++i) {
+        double price = i % 400 * 0.25; //Quarters, so the sums are exact in any order
+        ItemKind k = (ItemKind)(i % 3 == 0 ? 0 : i % 5);
+        switch (k) {
+            case ItemKind::Grocery: big.emplace<Grocery>("g" + to_string(i), price, "fresh"); break;
+            case ItemKind::Electronics: big.emplace<Electronics>("e" + to_string(i), price, i % 7); break;
+            case ItemKind::Clothing: big.emplace<Clothing>("c" + to_string(i), price, "M"); break;
+            case ItemKind::Book: big.emplace<Book>("b" + to_string(i), price, "Orwell"); break;
+            default: big.emplace<Toy>("t" + to_string(i), price, 5); break;
+        }
+        ++expected[(int)k].count;
+        expected[(int)k].total += price;
+    }
+    ItemStore bigStore;
+    for (const auto& i : big.getItems()) bigStore.add(*i);
+    CatalogReport b = ReportEngine(pool).run(bigStore);
+    bool same = true;
+    for (int k = 0; k < ITEM_KIND_COUNT; ++k) same = same && b.byType[k].count == expected[k].count && b.byType[k].total == expected[k].total;
+    CHECK(same);
+}
+
+}
+
+int main() {
+    RUN_TEST(nanPriceStaysInOrder);
+    RUN_TEST(textRecordsRejectNonFinitePrices);
+    RUN_TEST(priceQueriesMatchSortedPrices);
+    RUN_TEST(evictionMatchesScanAndReplays);
+    RUN_TEST(removalsAndOldRecords);
+    RUN_TEST(externalSortLeavesStringPoolAlone);
+    RUN_TEST(nameLookupsFollowChanges);
+    RUN_TEST(itemStoreMatchesContainer);
+    RUN_TEST(repackRoundTrips);
+    RUN_TEST(reportGroupsByType);
+    return checkResult();
+}
@@ -0,0 +1,183 @@
+//Journal replay, compaction, the compaction timer and write failures, with the items.txt snapshots of shopping_items.cpp,
+//and restoring a large items.txt on several threads
+#define SHOPPING_ITEMS_NO_MAIN
+#include "../shopping_items.cpp"
+#include "check.h"
+
+#include <csignal>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+namespace {
+
+string record(const Item& i) { //The items.txt line without its newline, as the menu logs it
+    ostringstream line;
+    i.persist(line);
+    string rec = line.str();
+    rec.pop_back();
+    return rec;
+}
+
+bool waitFor(function<bool()> done) { //Polls for up to five seconds
+    for (int k = 0; k < 500 && !done(); ++k) this_thread::sleep_for(chrono::milliseconds(10));
+    return done();
+}
+
+//Records survive a reopen, compaction moves them into the snapshot (in a
+//subdirectory, so the directory sync has a real parent) and empties the log
+void replaysAndCompacts() {
+    mkdir("journal_test_dir", 0755);
+    const string wal = "journal_test_dir/items.txt.wal", snapshot = "journal_test_dir/items.txt";
+    remove(wal.c_str());
+    remove(snapshot.c_str());
+    ItemArena arena;
+    vector<Item*> items;
+    {
+        Journal j;
+        CHECK(j.open(wal, 0, [](uint64_t, string_view) {}));
+        for (int i = 0; i < 5; ++i) {
+            items.push_back(arena.make<Toy>("toy" + to_string(i), i + 0.5, i));
+            j.append(record(*items.back()));
+        }
+    }
+    vector<string> replayed;
+    {
+        Journal j;
+        CHECK(j.open(wal, 0, [&](uint64_t, string_view rec) { replayed.emplace_back(rec); }));
+        CHECK(replayed.size() == 5 && replayed[4] == record(*items[4]));
+        CHECK(j.lastSeq() == 5);
+        j.compact(3, snapshotText(vector<Item*>(items.begin(), items.begin() + 3), 3), snapshot);
+        j.waitForCompaction();
+    }
+    uint64_t seq;
+    vector<Item*> restored = restore(snapshot, arena, nullptr, 1, &seq);
+    CHECK(restored.size() == 3 && seq == 3);
+    replayed.clear();
+    Journal j;
+    CHECK(j.open(wal, seq, [&](uint64_t, string_view rec) { replayed.emplace_back(rec); }));
+    CHECK(replayed.size() == 2 && replayed[0] == record(*items[3]));
+    j.close();
+    for (const string& f : { wal, snapshot }) remove(f.c_str());
+    rmdir("journal_test_dir");
+}
+
+//With a handler set, the journal's thread compacts on its own once records have
+//waited compactInterval, and leaves an empty log alone
+void compactionRunsOnATimer() {
+    remove("journal_timer.wal");
+    remove("journal_timer.txt");
+    ItemArena arena;
+    vector<Item*> items;
+    mutex catalog;
+    atomic<int> runs{ 0 };
+    JournalOptions opt;
+    opt.compactInterval = chrono::milliseconds(50);
+    Journal j;
+    CHECK(j.open("journal_timer.wal", 0, [](uint64_t, string_view) {}, opt));
+    j.setCompactionHandler([&] {
+        lock_guard<mutex> lock(catalog);
+        ++runs;
+        j.compact(j.lastSeq(), snapshotText(items, j.lastSeq()), "journal_timer.txt");
+    });
+    this_thread::sleep_for(chrono::milliseconds(300));
+    CHECK(runs == 0);
+
+    for (int i = 0; i < 3; ++i) {
+        lock_guard<mutex> lock(catalog);
+        items.push_back(arena.make<Book>("book" + to_string(i), 10.0 + i, "Austen"));
+        j.append(record(*items.back()));
+    }
+    uint64_t seq = 0;
+    CHECK(waitFor([&] { return restore("journal_timer.txt", arena, nullptr, 1, &seq).size() == 3 && seq == 3; }));
+    CHECK(waitFor([&] { struct stat st; return stat("journal_timer.wal", &st) == 0 && st.st_size == 0; }));
+    CHECK(runs >= 1);
+    j.close();
+    for (const char* f : { "journal_timer.wal", "journal_timer.txt" }) remove(f);
+}
+
+//A write the file size limit cuts short marks the log failed, later appends are
+//refused and close() says so, until a compaction covering everything succeeds
+void writeFailuresAreReported() {
+    remove("journal_fail.wal");
+    Journal j;
+    CHECK(j.open("journal_fail.wal", 0, [](uint64_t, string_view) {}));
+    CHECK(j.append("first") == 1 && j.sync() && !j.failed());
+    signal(SIGXFSZ, SIG_IGN); //write() then fails with EFBIG instead of killing the process
+    rlimit old;
+    getrlimit(RLIMIT_FSIZE, &old);
+    rlimit small = old;
+    small.rlim_cur = 64;
+    setrlimit(RLIMIT_FSIZE, &small);
+    for (int i = 0; i < 10; ++i) j.append("record number " + to_string(i));
+    bool synced = j.sync();
+    setrlimit(RLIMIT_FSIZE, &old);
+    CHECK(!synced && j.failed());
+    CHECK(j.append("refused") == 0);
+    CHECK(!j.sync());
+
+    j.compact(j.lastSeq(), "snapshot", "journal_fail_dir/missing/items.txt"); //Cannot be written
+    j.waitForCompaction();
+    CHECK(j.failed());
+    j.compact(j.lastSeq(), "snapshot", "journal_fail.txt");
+    j.waitForCompaction();
+    CHECK(!j.failed());
+    CHECK(j.append("after") == 12);
+    CHECK(j.close());
+    vector<uint64_t> seqs;
+    CHECK(j.open("journal_fail.wal", 11, [&](uint64_t seq, string_view) { seqs.push_back(seq); }));
+    CHECK(seqs == vector<uint64_t>{ 12 });
+    CHECK(j.close());
+    for (const char* f : { "journal_fail.wal", "journal_fail.txt" }) remove(f);
+}
+
+//A file of several MiB split over many chunks comes back in file order, with every
+//bad line reported under its own line number whichever chunk it fell in
+void parallelRestoreNumbersLines() {
+    string text = "#SEQ|42\n", expected;
+    vector<size_t> badLines;
+    size_t lineNo = 1;
+    for (int i = 0; text.size() < (3u << 20); ++i) {
+        string line;
+        ++lineNo;
+        switch (i % 1013) {
+        case 7: line = "TOY|t" + to_string(i) + "|nan|3"; badLines.push_back(lineNo); break;
+        case 300: line = "TOY|t" + to_string(i) + "|inf|3"; badLines.push_back(lineNo); break;
+        case 501: line = "Gadget|g" + to_string(i) + "|1.5|x"; badLines.push_back(lineNo); break;
+        case 800: line = "BOOK|only two"; badLines.push_back(lineNo); break;
+        case 900: line = "# a comment"; break;
+        default:
+            line = i % 2 ? "BOOK|b" + to_string(i) + "|" + to_string(i % 500) + ".5|Austen|Tolstoy" //Bars in the last field
+                         : "TOY|t" + to_string(i) + "|" + to_string(i % 300) + ".25|" + to_string(i % 12);
+            expected += line + "\n";
+        }
+        text += line + (i % 5 ? "\n" : "\r\n");
+    }
+    {
+        ofstream out("journal_restore.txt", ios::binary);
+        out << text;
+    }
+    ItemArena arena;
+    vector<RestoreError> errors;
+    uint64_t seq = 0;
+    vector<Item*> items = restore("journal_restore.txt", arena, &errors, 4, &seq);
+    string got;
+    for (Item* i : items) got += record(*i) + "\n";
+    CHECK(seq == 42);
+    CHECK(got == expected);
+    CHECK(errors.size() == badLines.size());
+    bool sameLines = errors.size() == badLines.size();
+    for (size_t k = 0; sameLines && k < errors.size(); ++k) sameLines = errors[k].line == badLines[k];
+    CHECK(sameLines);
+    CHECK(!errors.empty() && errors[0].message == "bad price 'nan'");
+    remove("journal_restore.txt");
+}
+
+}
+
+int main() {
+    RUN_TEST(replaysAndCompacts);
+    RUN_TEST(compactionRunsOnATimer);
+    RUN_TEST(writeFailuresAreReported);
+    RUN_TEST(parallelRestoreNumbersLines);
+    return checkResult();
+}
@@ -0,0 +1,10 @@
+#!/bin/sh
+#Types one item and half of another into a lab program's menu, then ends the input.
+#The program has to save and exit, keeping the first item and logging nothing else.
+#Usage: menu_eof_test.sh <program> <items file>, run in a directory of its own
+set -e
+rm -f "$2" "$2.wal"
+printf '5\nyoyo 3 7\n1\nmilk' | timeout 20 "$1" > /dev/null
+grep -aq yoyo "$2"
+if grep -aq milk "$2"; then exit 1; fi
+test ! -s "$2.wal"
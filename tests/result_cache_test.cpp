@@ -0,0 +1,78 @@
+//ResultCache lookups, inserts and CLOCK eviction, binOp2.cpp
+#define BINOP2_NO_MAIN
+#include "../binOp2.cpp"
+#include "check.h"
+
+#include <cmath>
+
+namespace {
+
+//Lookups hit what was inserted or evaluated, and miss everything else
+void findHitsInsertedEntries() {
+    ResultCache cache(64, 4);
+    double r;
+    unsigned char status;
+    CHECK(!cache.find(1, '+', 2, r, status));
+    cache.insert(1, '+', 2, 3, EVAL_OK);
+    CHECK(cache.find(1, '+', 2, r, status) && r == 3 && status == EVAL_OK);
+    CHECK(!cache.find(1, '-', 2, r, status)); //Operator is part of the key
+    CHECK(!cache.find(2, '+', 1, r, status));
+    cache.insert(1, '+', 2, 4, EVAL_OK); //Overwrites in place
+    CHECK(cache.find(1, '+', 2, r, status) && r == 4 && cache.size() == 1);
+
+    CHECK(cache.evaluate(1, '/', 0, r) == EVAL_DIVISION_BY_ZERO && std::isnan(r));
+    CHECK(cache.find(1, '/', 0, r, status) && status == EVAL_DIVISION_BY_ZERO); //Errors are remembered too
+    CHECK(cache.evaluate(6, '*', 7, r) == EVAL_OK && r == 42);
+    CHECK(cache.evaluate(6, '*', 7, r) == EVAL_OK && r == 42);
+    CHECK(cache.evaluate(0.0, '+', 1, r) == EVAL_OK && !cache.find(-0.0, '+', 1, r, status)); //Keys compare bitwise
+    CHECK(cache.hits() == 4 && cache.misses() == 7); //insert() counts neither
+}
+
+//A full shard evicts one entry per insert. Every entry the cache still counts has
+//to stay reachable after the backward-shift deletes moved the probe runs around.
+void fullShardEvictsAndKeepsProbeRuns() {
+    ResultCache cache(8, 1); //One shard of 8 entries in 16 slots
+    CHECK(cache.capacity() == 8);
+    double r;
+    unsigned char status;
+    for (int k = 0; k < 8; ++k) cache.insert(k, '+', 0, k, EVAL_OK);
+    for (int k = 0; k < 8; ++k) CHECK(cache.find(k, '+', 0, r, status) && r == k);
+    cache.insert(100, '+', 0, 100, EVAL_OK);
+    CHECK(cache.size() == 8);
+    int kept = 0;
+    for (int k = 0; k < 8; ++k) kept += cache.find(k, '+', 0, r, status) && r == k;
+    CHECK(kept == 7);
+    CHECK(cache.find(100, '+', 0, r, status) && r == 100);
+
+    //Second chance: an entry hit since the last sweep outlives one that was not
+    ResultCache clock(4, 1);
+    for (int k = 0; k < 4; ++k) clock.insert(k, '*', 1, k, EVAL_OK);
+    CHECK(clock.find(1, '*', 1, r, status) && clock.find(2, '*', 1, r, status));
+    clock.insert(10, '*', 1, 10, EVAL_OK);
+    clock.insert(11, '*', 1, 11, EVAL_OK);
+    CHECK(clock.find(1, '*', 1, r, status) && clock.find(2, '*', 1, r, status));
+    CHECK(!clock.find(0, '*', 1, r, status) && !clock.find(3, '*', 1, r, status));
+
+    //Long churn: delete, then probe for everything ever inserted
+    ResultCache churn(8, 1);
+    for (int k = 0; k < 5000; ++k) {
+        churn.insert(k, '-', 1, k - 1, EVAL_OK);
+        if (k % 3 == 0) churn.find(k / 2, '-', 1, r, status);
+        CHECK(churn.find(k, '-', 1, r, status) && r == k - 1); //The newest entry is never the one evicted
+    }
+    size_t reachable = 0;
+    bool right = true;
+    for (int k = 0; k < 5000; ++k)
+        if (churn.find(k, '-', 1, r, status)) { ++reachable; right = right && r == k - 1; }
+    CHECK(churn.size() == 8);
+    CHECK(reachable == churn.size());
+    CHECK(right);
+}
+
+}
+
+int main() {
+    RUN_TEST(findHitsInsertedEntries);
+    RUN_TEST(fullShardEvictsAndKeepsProbeRuns);
+    return checkResult();
+}
@@ -0,0 +1,94 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+//Fixed set of threads draining a FIFO of jobs, shared by the programs in this repo
+class WorkerPool {
+    std::vector<std::thread> threads;
+    std::queue<std::function<void()>> jobs;
+    std::mutex m;
+    std::condition_variable cv;
+    bool stopping = false;
+
+    void run() {
+        while (true) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(m);
+                cv.wait(lock, [&] { return stopping || !jobs.empty(); });
+                if (jobs.empty()) return; //Only reached when stopping
+                job = std::move(jobs.front());
+                jobs.pop();
+            }
+            job();
+        }
+    }
+
+public:
+    explicit WorkerPool(unsigned n = 0) {
+        if (n == 0) n = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned i = 0; i < n; ++i) threads.emplace_back([this] { run(); });
+    }
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+    ~WorkerPool() { //Finishes the queued jobs before joining
+        {
+            std::lock_guard<std::mutex> lock(m);
+            stopping = true;
+        }
+        cv.notify_all();
+        for (auto& t : threads) t.join();
+    }
+
+    unsigned size() const { return (unsigned)threads.size(); }
+
+    //Queues f and returns a future for its result, exceptions travel through the future
+    template <class F> auto submit(F f) -> std::future<decltype(f())> {
+        auto task = std::make_shared<std::packaged_task<decltype(f())()>>(std::move(f));
+        auto result = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(m);
+            jobs.emplace([task] { (*task)(); });
+        }
+        cv.notify_one();
+        return result;
+    }
+};
+
+//Splits [0, n) into one contiguous slice per pool thread, calls f(slice, begin, end)
+//for each and waits for all of them
+template <class F> void parallelFor(WorkerPool& pool, std::size_t n, F f) {
+    std::size_t slices = std::min<std::size_t>(pool.size(), std::max<std::size_t>(n, 1));
+    std::vector<std::future<void>> done;
+    for (std::size_t s = 0; s < slices; ++s) {
+        std::size_t begin = n * s / slices, end = n * (s + 1) / slices;
+        done.push_back(pool.submit([=, &f] { f(s, begin, end); }));
+    }
+    for (auto& d : done) d.get();
+}
+
+//Parallel reduction over [0, n): every slice starts from a copy of init, folds its
+//indices in with f(partial, i), and the partials are combined in slice order with
+//merge(total, partial)
+template <class T, class F, class Merge> T parallelReduce(WorkerPool& pool, std::size_t n, const T& init, F f, Merge merge) {
+    std::vector<T> partials(std::min<std::size_t>(pool.size(), std::max<std::size_t>(n, 1)), init);
+    parallelFor(pool, n, [&](std::size_t slice, std::size_t begin, std::size_t end) {
+        T& partial = partials[slice];
+        for (std::size_t i = begin; i < end; ++i) f(partial, i);
+    });
+    T total = std::move(partials[0]);
+    for (std::size_t s = 1; s < partials.size(); ++s) merge(total, partials[s]);
+    return total;
+}
+
+#endif